@@ -0,0 +1,20 @@
+/**
+ * Shared by the benchmarks: the whole shell is compiled into each of them,
+ * its main renamed out of the way, so they time the shell's own functions
+ */
+#ifndef SHELLISH_BENCH_H
+#define SHELLISH_BENCH_H
+
+#define main shellish_main
+#include "../shellish-skeleton.c"
+#undef main
+
+static inline uint64_t now_ns() {
+  struct timespec t;
+  clock_gettime(CLOCK_MONOTONIC, &t);
+  return t.tv_sec * 1000000000ull + t.tv_nsec;
+}
+
+static inline double now_seconds() { return now_ns() / 1e9; }
+
+#endif
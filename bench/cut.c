@@ -0,0 +1,118 @@
+/**
+ * cut -f throughput in GB/s over a generated TSV file: the byte at a time
+ * loop cut used to run, each delimiter finder through the streaming path,
+ * the mapped multi-threaded path, and coreutils cut on the same file.
+ *
+ * gcc -O2 -pthread -o bench-cut bench/cut.c
+ * ./bench-cut [MiB] [field list]
+ */
+#include "bench.h"
+
+//the search cut did before it was vectorized
+static const char *find_delim_bytes(const char *p, const char *end,
+                                    char delim) {
+  for (; p < end; p++)
+    if (*p == delim)
+      return p;
+  return NULL;
+}
+
+//ten tab separated fields of varying width per line
+static void write_tsv(const char *path, size_t bytes) {
+  FILE *f = fopen(path, "w");
+  if (!f) {
+    perror(path);
+    exit(EXIT_FAILURE);
+  }
+  unsigned seed = 6;
+  size_t written = 0;
+  while (written < bytes) {
+    for (int field = 0; field < 10; field++) {
+      int width = 2 + rand_r(&seed) % 14;
+      for (int i = 0; i < width; i++)
+        fputc('a' + rand_r(&seed) % 26, f);
+      fputc(field < 9 ? '\t' : '\n', f);
+      written += width + 1;
+    }
+  }
+  fclose(f);
+}
+
+static double bench_cut(struct cut_spec *spec, const char *path, bool mapped) {
+  int fd = open(path, O_RDONLY);
+  struct out_buffer out = {open("/dev/null", O_WRONLY), malloc(CUT_BLOCK_SIZE),
+                           0, CUT_BLOCK_SIZE};
+  double start = now_seconds();
+  if (!mapped || cut_mapped(spec, fd, &out) < 0)
+    cut_stream(spec, fd, &out);
+  out_flush(&out);
+  double seconds = now_seconds() - start;
+  close(out.fd);
+  free(out.data);
+  close(fd);
+  return seconds;
+}
+
+int main(int argc, char **argv) {
+  size_t mib = argc > 1 ? atoi(argv[1]) : 256;
+  const char *list = argc > 2 ? argv[2] : "2";
+  char path[] = "/tmp/bench-cut-XXXXXX";
+  int tmp = mkstemp(path);
+  if (tmp < 0) {
+    perror("mkstemp");
+    return EXIT_FAILURE;
+  }
+  close(tmp);
+  write_tsv(path, mib << 20);
+  struct stat st;
+  stat(path, &st);
+  double gb = st.st_size / 1e9;
+
+  struct cut_spec spec = {0};
+  spec.delimiter = '\t';
+  if (cut_compile_list(&spec, list, false) < 0)
+    return EXIT_FAILURE;
+  spec.output_delimiter = &spec.delimiter;
+  spec.output_delimiter_len = 1;
+  spec.find_delim = pick_delim_finder();
+
+  struct {
+    const char *name;
+    delim_finder find;
+    bool mapped;
+  } runs[] = {
+      {"byte loop", find_delim_bytes, false},
+      {"memchr", find_delim_scalar, false},
+#if defined(__x86_64__) || defined(__i386__)
+      {"sse2", find_delim_sse2, false},
+      {"avx2", find_delim_avx2, false},
+#endif
+      {"mapped, picked", pick_delim_finder(), true},
+  };
+
+  printf("%.2f GB, cut -f %s, %ld cpus\n", gb, list,
+         sysconf(_SC_NPROCESSORS_ONLN));
+  bench_cut(&spec, path, false); // page cache warm up
+  for (size_t i = 0; i < sizeof(runs) / sizeof(runs[0]); i++) {
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_cpu_init();
+    if (runs[i].find == find_delim_avx2 && !__builtin_cpu_supports("avx2"))
+      continue;
+#endif
+    spec.find_delim = runs[i].find;
+    double seconds = bench_cut(&spec, path, runs[i].mapped);
+    printf("%-16s %8.2f GB/s\n", runs[i].name, gb / seconds);
+  }
+
+  char shell_line[512];
+  snprintf(shell_line, sizeof(shell_line), "cut -f %s %s > /dev/null", list,
+           path);
+  double start = now_seconds();
+  if (system(shell_line) == 0)
+    printf("%-16s %8.2f GB/s\n", "coreutils cut",
+           gb / (now_seconds() - start));
+
+  free(spec.selected);
+  unlink(path);
+  return 0;
+}
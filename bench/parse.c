@@ -0,0 +1,105 @@
+/**
+ * Parser throughput over a generated corpus of command lines: quotes,
+ * escapes, redirects, pipelines and lists, with a plain strtok split of
+ * the same lines as the floor to compare against.
+ *
+ * gcc -O2 -pthread -o bench-parse bench/parse.c
+ * ./bench-parse [lines]
+ */
+#include "bench.h"
+
+static const char *words[] = {"ls",   "-la",  "grep", "cut",   "-f2",  "sort",
+                              "uniq", "-c",   "wc",   "-l",    "echo", "cat",
+                              "src",  "a.txt", "/usr/local/bin", "--color=auto"};
+#define WORD_COUNT (sizeof(words) / sizeof(words[0]))
+
+//one random line in the style of an interactive session
+static int corpus_line(char *out, size_t size, unsigned *seed) {
+  size_t len = 0;
+  int stages = 1 + rand_r(seed) % 4;
+  for (int s = 0; s < stages; s++) {
+    if (s > 0)
+      len += snprintf(out + len, size - len, rand_r(seed) % 3 ? " | " : "|");
+    int argc = 1 + rand_r(seed) % 5;
+    for (int a = 0; a < argc; a++) {
+      const char *w = words[rand_r(seed) % WORD_COUNT];
+      switch (rand_r(seed) % 8) {
+      case 0:
+        len += snprintf(out + len, size - len, " \"%s %s\"", w, w);
+        break;
+      case 1:
+        len += snprintf(out + len, size - len, " '%s|%s'", w, w);
+        break;
+      case 2:
+        len += snprintf(out + len, size - len, " %s\\ x", w);
+        break;
+      default:
+        len += snprintf(out + len, size - len, " %s", w);
+      }
+    }
+    if (rand_r(seed) % 6 == 0)
+      len += snprintf(out + len, size - len, " >out.txt");
+    if (rand_r(seed) % 8 == 0)
+      len += snprintf(out + len, size - len, " < in.txt");
+  }
+  static const char *tails[] = {"", "", "", " &", " && echo ok",
+                                " || echo failed", "; wc -l >>log"};
+  len += snprintf(out + len, size - len, "%s", tails[rand_r(seed) % 7]);
+  return len;
+}
+
+int main(int argc, char **argv) {
+  int lines = argc > 1 ? atoi(argv[1]) : 1000000;
+  char **corpus = malloc(sizeof(char *) * lines);
+  size_t bytes = 0, longest = 0;
+  unsigned seed = 304;
+  for (int i = 0; i < lines; i++) {
+    char line[1024];
+    int len = corpus_line(line, sizeof(line), &seed);
+    corpus[i] = strdup(line);
+    bytes += len;
+    if ((size_t)len > longest)
+      longest = len;
+  }
+  char *scratch = malloc(longest + 1);
+
+  // the floor: what splitting on blanks alone costs
+  long split_words = 0;
+  double start = now_seconds();
+  for (int i = 0; i < lines; i++) {
+    strcpy(scratch, corpus[i]);
+    char *save;
+    for (char *w = strtok_r(scratch, " \t", &save); w;
+         w = strtok_r(NULL, " \t", &save))
+      split_words++;
+  }
+  double split_seconds = now_seconds() - start;
+
+  int errors = 0;
+  long stages = 0;
+  start = now_seconds();
+  for (int i = 0; i < lines; i++) {
+    strcpy(scratch, corpus[i]);
+    struct command_t *command =
+        arena_alloc(&cmd_arena, sizeof(struct command_t));
+    errors += parse_command(scratch, command);
+    for (struct command_t *p = command; p; p = p->next_list)
+      for (struct command_t *c = p; c; c = c->next)
+        stages++;
+    free_command(command);
+  }
+  double parse_seconds = now_seconds() - start;
+
+  printf("%d lines, %.1f MB, %ld stages, %d syntax errors\n", lines,
+         bytes / 1e6, stages, errors);
+  printf("%-14s %10.1f MB/s %10.2f M lines/s\n", "strtok split",
+         bytes / 1e6 / split_seconds, lines / 1e6 / split_seconds);
+  printf("%-14s %10.1f MB/s %10.2f M lines/s\n", "parse_command",
+         bytes / 1e6 / parse_seconds, lines / 1e6 / parse_seconds);
+
+  for (int i = 0; i < lines; i++)
+    free(corpus[i]);
+  free(corpus);
+  free(scratch);
+  return split_words > 0 ? 0 : 1;
+}
@@ -0,0 +1,89 @@
+/**
+ * pstree on a synthetic process table: the parent -> children index, the
+ * iterative walk and line formatting, for a bushy random tree and for one
+ * chain as deep as the table. The per node scan pstree used to do is
+ * timed on a smaller table, it grows with the square of the size.
+ *
+ * gcc -O2 -pthread -o bench-pstree bench/pstree.c
+ * ./bench-pstree [processes] [processes for the quadratic scan]
+ */
+#include "bench.h"
+
+//pids are shuffled so the table is not already in tree order
+static struct processes *synthetic_table(int count, bool chain) {
+  struct processes *process = calloc(count, sizeof(struct processes));
+  int *pids = malloc(sizeof(int) * count);
+  unsigned seed = 15;
+  for (int i = 0; i < count; i++)
+    pids[i] = i + 1;
+  for (int i = count - 1; i > 0; i--) {
+    int j = rand_r(&seed) % (i + 1), t = pids[i];
+    pids[i] = pids[j];
+    pids[j] = t;
+  }
+  for (int i = 0; i < count; i++) {
+    process[i].pid = pids[i];
+    process[i].parentid =
+        i == 0 ? 0 : chain ? pids[i - 1] : pids[rand_r(&seed) % i];
+    snprintf(process[i].name, sizeof(process[i].name), "proc%d", pids[i]);
+    process[i].rss_pages = 1 + rand_r(&seed) % 1000;
+    process[i].cpu_ticks = rand_r(&seed) % 10000;
+  }
+  free(pids);
+  return process;
+}
+
+//the old walk: every visited node scans the whole table for its children
+static long quadratic_visit(const struct processes *process, int count,
+                            int pid, int depth) {
+  long visited = 1;
+  for (int i = 0; i < count; i++)
+    if (process[i].parentid == pid)
+      visited += quadratic_visit(process, count, process[i].pid, depth + 1);
+  return visited;
+}
+
+static void bench_indexed(const char *name, int count, bool chain) {
+  struct processes *process = synthetic_table(count, chain);
+  double start = now_seconds();
+  struct process_index index;
+  process_index_build(&index, process, count);
+  double built = now_seconds();
+  int node_count;
+  struct tree_node *nodes = tree_walk(&index, 0, (uid_t)-1, &node_count);
+  double walked = now_seconds();
+  char line[4096];
+  size_t bytes = 0;
+  for (int i = 0; i < node_count; i++)
+    bytes += tree_format_line(nodes, node_count, i, true, line, sizeof(line));
+  double formatted = now_seconds();
+  printf("%-8s %8d %7d %9.1f %9.1f %9.1f %9.1f %8.1f\n", name, count,
+         node_count, (built - start) * 1e3, (walked - built) * 1e3,
+         (formatted - walked) * 1e3, (formatted - start) * 1e3, bytes / 1e6);
+  free(nodes);
+  free(index.order);
+  free(process);
+}
+
+int main(int argc, char **argv) {
+  int count = argc > 1 ? atoi(argv[1]) : 100000;
+  int small = argc > 2 ? atoi(argv[2]) : 20000;
+
+  printf("%-8s %8s %7s %9s %9s %9s %9s %8s\n", "tree", "procs", "nodes",
+         "index ms", "walk ms", "format ms", "total ms", "MB out");
+  bench_indexed("random", count, false);
+  bench_indexed("chain", count, true);
+  bench_indexed("random", small, false);
+
+  struct processes *process = synthetic_table(small, false);
+  double start = now_seconds();
+  long visited = quadratic_visit(process, small, 0, 0) - 1;
+  double seconds = now_seconds() - start;
+  printf("per node scan of %d processes: %ld visited in %.1f ms, about "
+         "%.0f ms for %d\n",
+         small, visited, seconds * 1e3,
+         seconds * 1e3 * ((double)count / small) * ((double)count / small),
+         count);
+  free(process);
+  return 0;
+}
@@ -0,0 +1,237 @@
+/**
+ * Chatroom transports with many simulated users: the shared memory ring
+ * against one pipe per reader written through chat_broadcast. Every user
+ * is a reader thread, a few writer threads send timestamped messages, once
+ * flat out for throughput and once paced for latency.
+ *
+ * gcc -O2 -pthread -o bench-ring bench/ring.c
+ * ./bench-ring [users] [writers] [messages per writer]
+ */
+#include "bench.h"
+
+#define LATENCY_BUCKETS 10001 // 1us each, the last one is everything above
+
+struct bench_run {
+  bool shm;
+  int users, writers, messages;
+  int rate; // messages per second per writer, 0 for flat out
+  struct chat_ring *ring;
+  struct chat_peers peers; // write ends of the readers' pipes
+  int *read_fds;
+  _Atomic bool finished;
+  pthread_barrier_t ready;
+};
+
+struct bench_reader {
+  struct bench_run *run;
+  int id;
+  long received;
+  uint32_t *latency; // histogram in microseconds
+};
+
+static void bench_record(struct bench_reader *reader, const char *message,
+                         size_t len) {
+  const char *colon = memchr(message, ':', len);
+  if (!colon)
+    return;
+  uint64_t sent = strtoull(colon + 1, NULL, 10);
+  uint64_t us = (now_ns() - sent) / 1000;
+  reader->latency[us < LATENCY_BUCKETS - 1 ? us : LATENCY_BUCKETS - 1]++;
+  reader->received++;
+}
+
+static void *bench_ring_reader(void *arg) {
+  struct bench_reader *reader = arg;
+  struct bench_run *run = reader->run;
+  uint64_t cursor = atomic_load(&run->ring->head);
+  char message[CHAT_SLOT_DATA];
+  pthread_barrier_wait(&run->ready);
+  while (1) {
+    uint32_t wake = atomic_load(&run->ring->futex);
+    ssize_t len;
+    while ((len = chat_ring_try_read(run->ring, &cursor, message)) >= 0)
+      bench_record(reader, message, len);
+    if (atomic_load(&run->finished) &&
+        cursor >= atomic_load(&run->ring->head))
+      break;
+    struct timespec timeout = {0, 10 * 1000 * 1000};
+    chat_futex(&run->ring->futex, FUTEX_WAIT, wake, &timeout);
+  }
+  return NULL;
+}
+
+static void *bench_pipe_reader(void *arg) {
+  struct bench_reader *reader = arg;
+  struct bench_run *run = reader->run;
+  struct line_buffer received = {0};
+  char chunk[65536];
+  pthread_barrier_wait(&run->ready);
+  ssize_t r;
+  while ((r = read(run->read_fds[reader->id], chunk, sizeof(chunk))) > 0) {
+    line_buffer_append(&received, chunk, r);
+    size_t pos = 0;
+    char *line;
+    ssize_t len;
+    while ((len = line_buffer_next(&received, &pos, &line)) >= 0)
+      bench_record(reader, line, len);
+    line_buffer_consume(&received, pos);
+  }
+  free(received.data);
+  return NULL;
+}
+
+struct bench_writer {
+  struct bench_run *run;
+  int id;
+  uint64_t started; // when it left the barrier
+  uint64_t done;    // when its last message was out
+};
+
+static void *bench_writer(void *arg) {
+  struct bench_writer *writer = arg;
+  struct bench_run *run = writer->run;
+  char payload[48];
+  memset(payload, 'x', sizeof(payload) - 1);
+  payload[sizeof(payload) - 1] = 0;
+  pthread_barrier_wait(&run->ready);
+  uint64_t next = writer->started = now_ns();
+  for (int i = 0; i < run->messages; i++) {
+    if (run->rate) {
+      next += 1000000000ull / run->rate;
+      struct timespec at = {next / 1000000000ull, next % 1000000000ull};
+      clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &at, NULL);
+    }
+    char message[128];
+    int len = snprintf(message, sizeof(message), "user%d:%llu %s%s",
+                       writer->id, (unsigned long long)now_ns(), payload,
+                       run->shm ? "" : "\n");
+    if (run->shm)
+      chat_ring_publish(run->ring, message, len);
+    else
+      chat_broadcast(&run->peers, "", message, len);
+  }
+  writer->done = now_ns();
+  return NULL;
+}
+
+static void bench_transport(bool shm, int users, int writers, int messages,
+                            int rate) {
+  struct bench_run run = {.shm = shm, .users = users, .writers = writers,
+                          .messages = messages, .rate = rate};
+  char room[64];
+  snprintf(room, sizeof(room), "bench-%d", getpid());
+  if (shm) {
+    run.ring = chat_ring_open(room);
+    if (!run.ring)
+      exit(EXIT_FAILURE);
+  } else {
+    run.read_fds = malloc(sizeof(int) * users);
+    run.peers.list = calloc(users, sizeof(struct chat_peer));
+    run.peers.count = run.peers.cap = users;
+    for (int i = 0; i < users; i++) {
+      int fds[2];
+      if (pipe2(fds, O_CLOEXEC) < 0) {
+        perror("pipe");
+        exit(EXIT_FAILURE);
+      }
+      fcntl(fds[1], F_SETFL, O_NONBLOCK); // a full pipe drops, as in a room
+      run.read_fds[i] = fds[0];
+      run.peers.list[i].fd = fds[1];
+    }
+  }
+  pthread_barrier_init(&run.ready, NULL, users + writers + 1);
+
+  struct bench_reader *readers = calloc(users, sizeof(struct bench_reader));
+  pthread_t *threads = malloc(sizeof(pthread_t) * (users + writers));
+  for (int i = 0; i < users; i++) {
+    readers[i] = (struct bench_reader){&run, i, 0,
+                                       calloc(LATENCY_BUCKETS, sizeof(uint32_t))};
+    pthread_create(&threads[i], NULL,
+                   shm ? bench_ring_reader : bench_pipe_reader, &readers[i]);
+  }
+  struct bench_writer *writer_args = malloc(sizeof(struct bench_writer) * writers);
+  for (int i = 0; i < writers; i++) {
+    writer_args[i] = (struct bench_writer){&run, i, 0, 0};
+    pthread_create(&threads[users + i], NULL, bench_writer, &writer_args[i]);
+  }
+
+  pthread_barrier_wait(&run.ready);
+  // timed by the writers themselves, this thread may get the cpu only
+  // after fast writers are done
+  uint64_t start = UINT64_MAX, sent = 0;
+  for (int i = 0; i < writers; i++) {
+    pthread_join(threads[users + i], NULL);
+    if (writer_args[i].started < start)
+      start = writer_args[i].started;
+    if (writer_args[i].done > sent)
+      sent = writer_args[i].done;
+  }
+  if (shm) {
+    atomic_store(&run.finished, true);
+    atomic_fetch_add(&run.ring->futex, 1);
+    chat_futex(&run.ring->futex, FUTEX_WAKE, INT32_MAX, NULL);
+  } else {
+    for (int i = 0; i < users; i++)
+      close(run.peers.list[i].fd);
+  }
+  for (int i = 0; i < users; i++)
+    pthread_join(threads[i], NULL);
+  uint64_t end = now_ns();
+
+  long received = 0;
+  uint64_t *latency = calloc(LATENCY_BUCKETS, sizeof(uint64_t));
+  for (int i = 0; i < users; i++) {
+    received += readers[i].received;
+    for (int b = 0; b < LATENCY_BUCKETS; b++)
+      latency[b] += readers[i].latency[b];
+    free(readers[i].latency);
+  }
+  int p50 = -1, p99 = -1;
+  long seen = 0;
+  for (int b = 0; b < LATENCY_BUCKETS; b++) {
+    seen += latency[b];
+    if (p50 < 0 && seen * 2 >= received)
+      p50 = b;
+    if (p99 < 0 && seen * 100 >= received * 99)
+      p99 = b;
+  }
+  long expected = (long)writers * messages * users;
+  printf("%-5s %-9s %11.0f %13.0f %9.1f%% %7d %7d%s\n", shm ? "ring" : "pipes",
+         rate ? "paced" : "flat out",
+         writers * (double)messages * 1e9 / (sent - start),
+         received * 1e9 / (end - start), 100.0 * received / expected, p50, p99,
+         p99 == LATENCY_BUCKETS - 1 ? "+" : "");
+
+  free(latency);
+  free(writer_args);
+  free(threads);
+  free(readers);
+  pthread_barrier_destroy(&run.ready);
+  if (shm) {
+    chat_ring_close(run.ring, room);
+  } else {
+    for (int i = 0; i < users; i++)
+      close(run.read_fds[i]);
+    free(run.read_fds);
+    free(run.peers.list);
+  }
+}
+
+int main(int argc, char **argv) {
+  int users = argc > 1 ? atoi(argv[1]) : 64;
+  int writers = argc > 2 ? atoi(argv[2]) : 4;
+  int messages = argc > 3 ? atoi(argv[3]) : 20000;
+  int rate = 1000; // per writer when paced
+
+  printf("%d users, %d writers, %d messages each, paced at %d/s per writer, "
+         "%ld cpus\n",
+         users, writers, messages, rate, sysconf(_SC_NPROCESSORS_ONLN));
+  printf("%-5s %-9s %11s %13s %10s %7s %7s\n", "", "", "sent/s",
+         "delivered/s", "delivered", "p50 us", "p99 us");
+  bench_transport(true, users, writers, messages, 0);
+  bench_transport(false, users, writers, messages, 0);
+  int paced = messages / 10 > 0 ? messages / 10 : 1;
+  bench_transport(true, users, writers, paced, rate);
+  bench_transport(false, users, writers, paced, rate);
+  return 0;
+}
@@ -0,0 +1,70 @@
+/**
+ * Launch latency of an external command: the shell's posix_spawn path
+ * against fork + exec_command, with a growing resident heap standing in
+ * for history, caches and job tables.
+ *
+ * gcc -O2 -pthread -o bench-spawn bench/spawn.c
+ * ./bench-spawn [launches] [heap MiB...]
+ */
+#include "bench.h"
+
+//microseconds per launch and wait of /bin/true
+static double bench_launch(struct command_t *command, bool spawn,
+                           int launches) {
+  int unused[1][2];
+  double start = now_seconds();
+  for (int i = 0; i < launches; i++) {
+    pid_t pid;
+    if (spawn) {
+      if (spawn_command(command, unused, 1, 0, 0, &pid) != 0) {
+        perror("posix_spawn");
+        exit(EXIT_FAILURE);
+      }
+    } else {
+      pid = fork();
+      if (pid < 0) {
+        perror("fork");
+        exit(EXIT_FAILURE);
+      }
+      if (pid == 0)
+        exec_command(command);
+    }
+    waitpid(pid, NULL, 0);
+  }
+  return (now_seconds() - start) * 1e6 / launches;
+}
+
+int main(int argc, char **argv) {
+  int launches = argc > 1 ? atoi(argv[1]) : 2000;
+  static const int default_sizes[] = {0, 64, 512};
+  int size_count = argc > 2 ? argc - 2 : 3;
+
+  char *args[] = {"true", NULL};
+  struct command_t command = {0};
+  command.name = "true";
+  command.args = args;
+  command.arg_count = 1;
+  command.path = path_resolver("true");
+  if (!command.path) {
+    fprintf(stderr, "true not found in PATH\n");
+    return EXIT_FAILURE;
+  }
+
+  printf("%-10s %14s %14s %8s\n", "heap MiB", "fork+exec us", "spawn us",
+         "ratio");
+  char *heap = NULL;
+  for (int i = 0; i < size_count; i++) {
+    size_t mib = argc > 2 ? atoi(argv[i + 2]) : default_sizes[i];
+    free(heap);
+    heap = mib ? malloc(mib << 20) : NULL;
+    if (heap)
+      memset(heap, 1, mib << 20); // resident, so fork copies its page tables
+    bench_launch(&command, true, launches / 10 + 1); // warm up
+    double forked = bench_launch(&command, false, launches);
+    double spawned = bench_launch(&command, true, launches);
+    printf("%-10zu %14.1f %14.1f %7.2fx\n", mib, forked, spawned,
+           forked / spawned);
+  }
+  free(heap);
+  return 0;
+}
@@ -1,6 +1,8 @@
+#define _GNU_SOURCE // memrchr
 #include <errno.h>
 #include <stdbool.h>
 #include <stdio.h>
+#include <stdio_ext.h> // __fpurge
 #include <stdlib.h>
 #include <string.h>
 #include <sys/wait.h>
@@ -12,6 +14,28 @@
 #include <dirent.h> 
 #include <signal.h>
 #include <ctype.h>
+#include <spawn.h>
+#include <sys/mman.h>
+#include <pthread.h>
+#include <sys/inotify.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include <time.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <limits.h>
+#include <poll.h>
+#include <sys/timerfd.h>
+#include <pwd.h>
+#include <sys/ioctl.h>
+#include <sys/file.h> // flock
+#include <sys/resource.h>
+#include <sys/time.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#endif
 const char *sysname = "shellish";
 
 enum return_codes {
@@ -27,7 +51,16 @@ struct command_t {
   int arg_count;
   char **args;
   char *redirects[3];     // in/out redirection
+  char *path;             // resolved executable, filled before fork
   struct command_t *next; // for piping
+  struct command_t *next_list; // next pipeline after ; & && ||
+  int list_op;                 // how next_list runs, see list_ops
+};
+
+enum list_ops {
+  LIST_SEQ = 0, // ; & or end of line, always run
+  LIST_AND,     // && run if this pipeline succeeded
+  LIST_OR,      // || run if this pipeline failed
 };
 
 /**
@@ -50,944 +83,5147 @@ void print_command(struct command_t *command) {
     printf("\tPiped to:\n");
     print_command(command->next);
   }
+  if (command->next_list) {
+    printf("\tThen (%s):\n", command->list_op == LIST_AND  ? "&&"
+                             : command->list_op == LIST_OR ? "||"
+                                                           : ";");
+    print_command(command->next_list);
+  }
 }
 
 /**
- * Release allocated memory of a command
- * @param  command [description]
- * @return         [description]
+ * Bump allocator holding everything parsed from one command line. The
+ * command_t chain, the argument arrays and the token text all live here and
+ * are dropped together by arena_reset.
  */
-int free_command(struct command_t *command) {
-  if (command->arg_count) {
-    for (int i = 0; i < command->arg_count; ++i)
-      free(command->args[i]);
-    free(command->args);
-  }
-  for (int i = 0; i < 3; ++i)
-    if (command->redirects[i])
-      free(command->redirects[i]);
-  if (command->next) {
-    free_command(command->next);
-    command->next = NULL;
+#define ARENA_BLOCK_SIZE 8192
+
+struct arena_block {
+  struct arena_block *next;
+  size_t size;
+  size_t used;
+  char data[];
+};
+
+struct arena {
+  struct arena_block *head;
+};
+
+static struct arena cmd_arena;
+
+/**
+ * Allocate zeroed memory from an arena
+ * @param  a    [description]
+ * @param  size [description]
+ * @return      [description]
+ */
+void *arena_alloc(struct arena *a, size_t size) {
+  size = (size + 15) & ~(size_t)15;
+  struct arena_block *b = a->head;
+  if (!b || b->size - b->used < size) {
+    size_t block = size > ARENA_BLOCK_SIZE ? size : ARENA_BLOCK_SIZE;
+    if (b && block < b->size * 2)
+      block = b->size * 2;
+    b = malloc(sizeof(struct arena_block) + block);
+    b->size = block;
+    b->used = 0;
+    b->next = a->head;
+    a->head = b;
   }
-  free(command->name);
-  free(command);
-  return 0;
+  void *p = b->data + b->used;
+  b->used += size;
+  memset(p, 0, size);
+  return p;
 }
 
 /**
- * Show the command prompt
- * @return [description]
+ * Drop everything allocated from an arena. The newest (largest) block is
+ * kept, so a shell reading similar lines stops calling malloc at all.
+ * @param a [description]
  */
-int show_prompt() {
-  char cwd[1024], hostname[1024];
-  gethostname(hostname, sizeof(hostname));
-  getcwd(cwd, sizeof(cwd));
-  printf("%s@%s:%s %s$ ", getenv("USER"), hostname, cwd, sysname);
-  return 0;
+void arena_reset(struct arena *a) {
+  struct arena_block *b = a->head;
+  if (!b)
+    return;
+  struct arena_block *rest = b->next;
+  while (rest) {
+    struct arena_block *next = rest->next;
+    free(rest);
+    rest = next;
+  }
+  b->next = NULL;
+  b->used = 0;
 }
 
 /**
- * Parse a command string into a command struct
- * @param  buf     [description]
+ * Release allocated memory of a command
  * @param  command [description]
- * @return         0
+ * @return         [description]
  */
-int parse_command(char *buf, struct command_t *command) {
-  const char *splitters = " \t"; // split at whitespace
-  int index, len;
-  len = strlen(buf);
-  while (len > 0 && strchr(splitters, buf[0]) != NULL) // trim left whitespace
-  {
-    buf++;
-    len--;
+int free_command(struct command_t *command) {
+  // resolved paths come from path_resolver, the rest lives in the arena
+  for (struct command_t *p = command; p; p = p->next_list) {
+    for (struct command_t *c = p; c; c = c->next) {
+      free(c->path);
+      c->path = NULL;
+    }
   }
-  while (len > 0 && strchr(splitters, buf[len - 1]) != NULL)
-    buf[--len] = 0; // trim right whitespace
+  arena_reset(&cmd_arena);
+  return 0;
+}
 
-  if (len > 0 && buf[len - 1] == '?') // auto-complete
-    command->auto_complete = true;
-  if (len > 0 && buf[len - 1] == '&') // background
-    command->background = true;
+//the prompt format is compiled once into segments, user, host and cwd are
+//cached so drawing a prompt needs no system call besides the write
+#define PROMPT_DEFAULT_FORMAT "\\u@\\H:\\w \\s$ "
 
-  char *pch = strtok(buf, splitters);
-  if (pch == NULL) {
-    command->name = (char *)malloc(1);
-    command->name[0] = 0;
-  } else {
-    command->name = (char *)malloc(strlen(pch) + 1);
-    strcpy(command->name, pch);
-  }
+enum prompt_segment_types {
+  SEG_TEXT,
+  SEG_USER,      // \u
+  SEG_HOST,      // \h, up to the first dot
+  SEG_HOST_FULL, // \H
+  SEG_CWD,       // \w
+  SEG_CWD_BASE,  // \W
+  SEG_SHELL,     // \s
+  SEG_DOLLAR,    // \$, # for root
+};
 
-  command->args = (char **)malloc(sizeof(char *));
+struct prompt_segment {
+  int type;
+  char *text; // SEG_TEXT only
+  size_t len;
+};
 
-  int redirect_index;
-  int arg_index = 0;
-  char temp_buf[1024], *arg;
-  while (1) {
-    // tokenize input on splitters
-    pch = strtok(NULL, splitters);
-    if (!pch)
-      break;
-    arg = temp_buf;
-    strcpy(arg, pch);
-    len = strlen(arg);
-
-    if (len == 0)
-      continue; // empty arg, go for next
-    while (len > 0 && strchr(splitters, arg[0]) != NULL) // trim left whitespace
-    {
-      arg++;
-      len--;
-    }
-    while (len > 0 && strchr(splitters, arg[len - 1]) != NULL)
-      arg[--len] = 0; // trim right whitespace
-    if (len == 0)
-      continue; // empty arg, go for next
+static struct {
+  bool ready;
+  struct prompt_segment *segments;
+  int count;
+  char user[256];
+  char host[256];
+  size_t host_short_len;
+  char cwd[PATH_MAX];
+  size_t cwd_len;
+  int width; // columns of the last prompt line, for the line editor
+} prompt_cache;
 
-    // piping to another command
-    if (strcmp(arg, "|") == 0) {
-      struct command_t *c =
-          (struct command_t *)malloc(sizeof(struct command_t));
-      int l = strlen(pch);
-      pch[l] = splitters[0]; // restore strtok termination
-      index = 1;
-      while (pch[index] == ' ' || pch[index] == '\t')
-        index++; // skip whitespaces
+static void prompt_add_text(const char *text, size_t len) {
+  if (len == 0)
+    return;
+  struct prompt_segment *last =
+      prompt_cache.count > 0 ? &prompt_cache.segments[prompt_cache.count - 1]
+                             : NULL;
+  if (last && last->type == SEG_TEXT) { // merge runs of literal text
+    last->text = realloc(last->text, last->len + len);
+    memcpy(last->text + last->len, text, len);
+    last->len += len;
+    return;
+  }
+  prompt_cache.segments =
+      realloc(prompt_cache.segments,
+              sizeof(struct prompt_segment) * (prompt_cache.count + 1));
+  struct prompt_segment *seg = &prompt_cache.segments[prompt_cache.count++];
+  seg->type = SEG_TEXT;
+  seg->text = malloc(len);
+  memcpy(seg->text, text, len);
+  seg->len = len;
+}
 
-      parse_command(pch + index, c);
-      pch[l] = 0; // put back strtok termination
-      command->next = c;
+/**
+ * Compile a PS1 style format. Supported: \u \h \H \w \W \s \$ \n \e \\,
+ * \nnn octal and \[ \] which are dropped.
+ * @param format [description]
+ */
+void prompt_compile(const char *format) {
+  for (const char *p = format; *p; p++) {
+    if (*p != '\\' || p[1] == '\0') {
+      prompt_add_text(p, 1);
       continue;
     }
-
-    // background process
-    if (strcmp(arg, "&") == 0)
-      continue; // handled before
-
-    // handle input redirection
-    redirect_index = -1;
-    if (arg[0] == '<')
-      redirect_index = 0;
-    if (arg[0] == '>') {
-      if (len > 1 && arg[1] == '>') {
-        redirect_index = 2;
-        arg++;
-        len--;
-      } else
-        redirect_index = 1;
+    p++;
+    int type = -1;
+    char c = *p;
+    switch (c) {
+    case 'u': type = SEG_USER; break;
+    case 'h': type = SEG_HOST; break;
+    case 'H': type = SEG_HOST_FULL; break;
+    case 'w': type = SEG_CWD; break;
+    case 'W': type = SEG_CWD_BASE; break;
+    case 's': type = SEG_SHELL; break;
+    case '$': type = SEG_DOLLAR; break;
+    case 'n': prompt_add_text("\n", 1); break;
+    case 'e': prompt_add_text("\033", 1); break;
+    case '[': case ']': break; // only mark non printing parts for bash
+    default:
+      if (c >= '0' && c <= '7') {
+        int value = 0;
+        for (int i = 0; i < 3 && *p >= '0' && *p <= '7'; i++, p++)
+          value = value * 8 + (*p - '0');
+        p--;
+        char byte = value;
+        prompt_add_text(&byte, 1);
+      } else {
+        prompt_add_text(p, 1); // \\ and unknown ones are literal
+      }
     }
-    if (redirect_index != -1) {
-      command->redirects[redirect_index] = (char *)malloc(len);
-      strcpy(command->redirects[redirect_index], arg + 1);
+    if (type < 0)
       continue;
-    }
-
-    // normal arguments
-    if (len > 2 &&
-        ((arg[0] == '"' && arg[len - 1] == '"') ||
-         (arg[0] == '\'' && arg[len - 1] == '\''))) // quote wrapped arg
-    {
-      arg[--len] = 0;
-      arg++;
-    }
-    command->args =
-        (char **)realloc(command->args, sizeof(char *) * (arg_index + 1));
-    command->args[arg_index] = (char *)malloc(len + 1);
-    strcpy(command->args[arg_index++], arg);
+    prompt_cache.segments =
+        realloc(prompt_cache.segments,
+                sizeof(struct prompt_segment) * (prompt_cache.count + 1));
+    prompt_cache.segments[prompt_cache.count++] =
+        (struct prompt_segment){type, NULL, 0};
   }
-  command->arg_count = arg_index;
+}
+
+/**
+ * Remember the current directory shown in the prompt and exported as PWD
+ * @param cwd absolute path
+ */
+void prompt_set_cwd(const char *cwd) {
+  snprintf(prompt_cache.cwd, sizeof(prompt_cache.cwd), "%s", cwd);
+  prompt_cache.cwd_len = strlen(prompt_cache.cwd);
+  setenv("PWD", prompt_cache.cwd, 1);
+}
 
-  // increase args size by 2
-  command->args = (char **)realloc(command->args,
-                                   sizeof(char *) * (command->arg_count += 2));
+const char *prompt_cwd() { return prompt_cache.cwd; }
+
+/**
+ * Fill the cache: user, host and cwd once, and the format from $PS1
+ */
+void prompt_init() {
+  const char *user = getenv("USER");
+  if (!user) {
+    struct passwd *pw = getpwuid(getuid());
+    user = pw ? pw->pw_name : "?";
+  }
+  snprintf(prompt_cache.user, sizeof(prompt_cache.user), "%s", user);
 
-  // shift everything forward by 1
-  for (int i = command->arg_count - 2; i > 0; --i)
-    command->args[i] = command->args[i - 1];
+  gethostname(prompt_cache.host, sizeof(prompt_cache.host) - 1);
+  prompt_cache.host_short_len = strcspn(prompt_cache.host, ".");
 
-  // set args[0] as a copy of name
-  command->args[0] = strdup(command->name);
-  // set args[arg_count-1] (last) to NULL
-  command->args[command->arg_count - 1] = NULL;
+  // trust $PWD if it still names this directory, it keeps symlinks
+  const char *pwd = getenv("PWD");
+  struct stat a, b;
+  char cwd[PATH_MAX];
+  if (pwd && pwd[0] == '/' && stat(pwd, &a) == 0 && stat(".", &b) == 0 &&
+      a.st_dev == b.st_dev && a.st_ino == b.st_ino)
+    prompt_set_cwd(pwd);
+  else if (getcwd(cwd, sizeof(cwd)))
+    prompt_set_cwd(cwd);
 
-  return 0;
+  const char *format = getenv("PS1");
+  prompt_compile(format && format[0] ? format : PROMPT_DEFAULT_FORMAT);
+  prompt_cache.ready = true;
 }
 
-void prompt_backspace() {
-  putchar(8);   // go back 1
-  putchar(' '); // write empty over
-  putchar(8);   // go back 1 again
+static size_t prompt_put(char *out, size_t len, size_t size, const char *text,
+                         size_t text_len) {
+  if (text_len > size - len)
+    text_len = size - len;
+  memcpy(out + len, text, text_len);
+  return len + text_len;
 }
 
 /**
- * Prompt a command from the user
- * @param  buf      [description]
- * @param  buf_size [description]
- * @return          [description]
+ * Show the command prompt, rendered from the cache in one write
+ * @return [description]
  */
-int prompt(struct command_t *command) {
-  int index = 0;
-  char c;
-  char buf[4096];
-  static char oldbuf[4096];
-
-  // tcgetattr gets the parameters of the current terminal
-  // STDIN_FILENO will tell tcgetattr that it should write the settings
-  // of stdin to oldt
-  static struct termios backup_termios, new_termios;
-  tcgetattr(STDIN_FILENO, &backup_termios);
-  new_termios = backup_termios;
-  // ICANON normally takes care that one line at a time will be processed
-  // that means it will return if it sees a "\n" or an EOF or an EOL
-  new_termios.c_lflag &=
-      ~(ICANON |
-        ECHO); // Also disable automatic echo. We manually echo each char.
-  // Those new settings will be set to STDIN
-  // TCSANOW tells tcsetattr to change attributes immediately.
-  tcsetattr(STDIN_FILENO, TCSANOW, &new_termios);
-
-  show_prompt();
-  buf[0] = 0;
-  while (1) {
-    c = getchar();
-    // printf("Keycode: %u\n", c); // DEBUG: uncomment for debugging
-
-    if (c == 9) // handle tab
-    {
-      buf[index++] = '?'; // autocomplete
+int show_prompt() {
+  if (!prompt_cache.ready)
+    prompt_init();
+  char out[PATH_MAX + 1024];
+  size_t len = 0, size = sizeof(out);
+  for (int i = 0; i < prompt_cache.count; i++) {
+    const struct prompt_segment *seg = &prompt_cache.segments[i];
+    switch (seg->type) {
+    case SEG_TEXT:
+      len = prompt_put(out, len, size, seg->text, seg->len);
+      break;
+    case SEG_USER:
+      len = prompt_put(out, len, size, prompt_cache.user,
+                       strlen(prompt_cache.user));
+      break;
+    case SEG_HOST:
+      len = prompt_put(out, len, size, prompt_cache.host,
+                       prompt_cache.host_short_len);
+      break;
+    case SEG_HOST_FULL:
+      len = prompt_put(out, len, size, prompt_cache.host,
+                       strlen(prompt_cache.host));
+      break;
+    case SEG_CWD:
+      len = prompt_put(out, len, size, prompt_cache.cwd, prompt_cache.cwd_len);
+      break;
+    case SEG_CWD_BASE: {
+      const char *base = strrchr(prompt_cache.cwd, '/');
+      base = base && base[1] ? base + 1 : prompt_cache.cwd;
+      len = prompt_put(out, len, size, base, strlen(base));
       break;
     }
-
-    if (c == 127) // handle backspace
-    {
-      if (index > 0) {
-        prompt_backspace();
-        index--;
-      }
-      continue;
+    case SEG_SHELL:
+      len = prompt_put(out, len, size, sysname, strlen(sysname));
+      break;
+    case SEG_DOLLAR:
+      len = prompt_put(out, len, size, geteuid() == 0 ? "#" : "$", 1);
+      break;
     }
-
-    if (c == 27 || c == 91 || c == 66 || c == 67 || c == 68) {
-      continue;
+  }
+  // visible width, escape sequences and utf-8 continuation bytes take none
+  prompt_cache.width = 0;
+  for (size_t i = 0; i < len; i++) {
+    unsigned char c = out[i];
+    if (c == '\033' && i + 1 < len && out[i + 1] == '[') {
+      for (i += 2; i < len && (out[i] < 0x40 || out[i] > 0x7e); i++)
+        ;
+    } else if (c == '\n' || c == '\r') {
+      prompt_cache.width = 0;
+    } else if (c >= ' ' && c != 0x7f && (c & 0xc0) != 0x80) {
+      prompt_cache.width++;
     }
+  }
 
-    if (c == 65) // up arrow
-    {
-      while (index > 0) {
-        prompt_backspace();
-        index--;
-      }
-
-      char tmpbuf[4096];
-      printf("%s", oldbuf);
-      strcpy(tmpbuf, buf);
-      strcpy(buf, oldbuf);
-      strcpy(oldbuf, tmpbuf);
-      index += strlen(buf);
+  fflush(stdout); // anything printed before belongs above the prompt
+  for (size_t done = 0; done < len;) {
+    ssize_t r = write(STDOUT_FILENO, out + done, len - done);
+    if (r < 0 && errno == EINTR)
       continue;
-    }
-
-    putchar(c); // echo the character
-    buf[index++] = c;
-    if (index >= sizeof(buf) - 1)
+    if (r <= 0)
       break;
-    if (c == '\n') // enter key
-      break;
-    if (c == 4) // Ctrl+D
-      return EXIT;
+    done += r;
   }
-  if (index > 0 && buf[index - 1] == '\n') // trim newline from the end
-    index--;
-  buf[index++] = '\0'; // null terminate string
-
-  strcpy(oldbuf, buf);
-
-  parse_command(buf, command);
-
-  // print_command(command); // DEBUG: uncomment for debugging
-
-  // restore the old settings
-  tcsetattr(STDIN_FILENO, TCSANOW, &backup_termios);
-  return SUCCESS;
+  return 0;
 }
-char *path_resolver(char *command) {
-  //command has a slash we return its copy
- 
-       	if (strchr(command, '/')) {
-   
-	  return strdup(command);
+
+/**
+ * Resolve a cd argument against the cached cwd, . and .. are applied to
+ * the text like other shells do, so symlinked directories stay as typed
+ * @param  dir [description]
+ * @param  out [description]
+ * @param  size [description]
+ * @return     0, or -1 if it does not fit
+ */
+int prompt_logical_path(const char *dir, char *out, size_t size) {
+  size_t len = 0;
+  bool appended = false;
+  if (dir[0] != '/') {
+    len = strlen(prompt_cwd());
+    if (len >= size)
+      return -1;
+    memcpy(out, prompt_cwd(), len);
+  }
+  while (len > 0 && out[len - 1] == '/')
+    len--;
+  for (const char *p = dir; *p;) {
+    while (*p == '/')
+      p++;
+    size_t part = strcspn(p, "/");
+    if (part == 0)
+      break;
+    if (part == 1 && p[0] == '.') {
+      // stay
+    } else if (part == 2 && p[0] == '.' && p[1] == '.') {
+      struct stat st;
+      out[len] = '\0';
+      if (appended && (stat(out, &st) < 0 || !S_ISDIR(st.st_mode)))
+        return -1; // no walking out of a directory that is not there
+      while (len > 0 && out[len - 1] != '/')
+        len--;
+      if (len > 0)
+        len--; // the slash
+    } else {
+      if (len + 1 + part >= size)
+        return -1;
+      out[len++] = '/';
+      memcpy(out + len, p, part);
+      len += part;
+      appended = true;
+    }
+    p += part;
   }
+  if (len == 0)
+    out[len++] = '/';
+  out[len] = '\0';
+  return 0;
+}
 
-  // getting path
-  char *enviroment_path = getenv("PATH");
-  if (!enviroment_path){
-	  return strdup(command);
-	  }
+enum token_types {
+  TOK_WORD,
+  TOK_PIPE,   // |
+  TOK_IN,     // <
+  TOK_OUT,    // >
+  TOK_APPEND, // >>
+  TOK_AMP,    // &
+  TOK_SEMI,   // ;
+  TOK_AND,    // &&
+  TOK_OR,     // ||
+  TOK_END,
+};
 
-  // copy path
-  char *copyp = strdup(enviroment_path);
+struct token {
+  int type;
+  char *text; // unquoted word, NULL for operators
+};
 
-  char *directory = strtok(copyp, ":");
+static const char *token_names[] = {"word", "|", "<",  ">",  ">>",
+                                    "&",    ";", "&&", "||", "newline"};
 
-  char buffybuffer[1024];
+/**
+ * Split a line into tokens in one pass. Quotes and backslashes are removed
+ * while copying word text into the arena, operators need no whitespace
+ * around them.
+ * @param  buf    [description]
+ * @param  len    [description]
+ * @param  tokens array of at least len + 1 entries
+ * @return        number of tokens before TOK_END, -1 on unterminated quote
+ */
+int tokenize(const char *buf, int len, struct token *tokens) {
+  // unquoted text never grows, plus one terminator per word
+  char *out = arena_alloc(&cmd_arena, len * 2 + 1);
+  int count = 0;
+  int i = 0;
 
-  // looping for path
-  while (directory != NULL) {
-    snprintf(buffybuffer, sizeof(buffybuffer), "%s/%s", directory, command);
+  while (i < len) {
+    char ch = buf[i];
+    if (ch == ' ' || ch == '\t' || ch == '\n') {
+      i++;
+      continue;
+    }
 
-    // checking for execution
-    if (access(buffybuffer, X_OK) == 0) {
-     
-	    free(copyp);
-    
-	    return strdup(buffybuffer);
+    struct token *t = &tokens[count++];
+    t->text = NULL;
+    bool twice = i + 1 < len && buf[i + 1] == ch;
+    switch (ch) {
+    case '|':
+      t->type = twice ? TOK_OR : TOK_PIPE;
+      i += twice ? 2 : 1;
+      continue;
+    case '&':
+      t->type = twice ? TOK_AND : TOK_AMP;
+      i += twice ? 2 : 1;
+      continue;
+    case '>':
+      t->type = twice ? TOK_APPEND : TOK_OUT;
+      i += twice ? 2 : 1;
+      continue;
+    case '<':
+      t->type = TOK_IN;
+      i++;
+      continue;
+    case ';':
+      t->type = TOK_SEMI;
+      i++;
+      continue;
     }
-    directory = strtok(NULL, ":"); //next directory
+
+    // word: runs until unquoted whitespace or operator
+    t->type = TOK_WORD;
+    t->text = out;
+    char quote = 0;
+    while (i < len) {
+      ch = buf[i];
+      if (quote == '\'') {
+        if (ch == '\'')
+          quote = 0;
+        else
+          *out++ = ch;
+        i++;
+      } else if (quote == '"') {
+        if (ch == '"')
+          quote = 0;
+        else if (ch == '\\' && i + 1 < len &&
+                 (buf[i + 1] == '"' || buf[i + 1] == '\\')) {
+          *out++ = buf[++i];
+        } else
+          *out++ = ch;
+        i++;
+      } else {
+        if (ch == ' ' || ch == '\t' || ch == '\n' || strchr("|&<>;", ch))
+          break;
+        if (ch == '\'' || ch == '"')
+          quote = ch;
+        else if (ch == '\\' && i + 1 < len)
+          *out++ = buf[++i];
+        else
+          *out++ = ch;
+        i++;
+      }
+    }
+    *out++ = 0;
+    if (quote)
+      return -1;
   }
 
-  free(copyp);
- 
-  return strdup(command); //back to original command
+  tokens[count].type = TOK_END;
+  tokens[count].text = NULL;
+  return count;
 }
 
+/**
+ * Parse a command string into a command struct. Pipelines are linked by
+ * next, pipelines of a list by next_list.
+ * @param  buf     [description]
+ * @param  command [description]
+ * @return         0, or 1 on a syntax error (command is left empty)
+ */
+int parse_command(char *buf, struct command_t *command) {
+  int len = strlen(buf);
+  int trimmed = len;
+  while (trimmed > 0 && strchr(" \t\n", buf[trimmed - 1]) != NULL)
+    trimmed--;
+  if (trimmed > 0 && buf[trimmed - 1] == '?') // auto-complete
+    command->auto_complete = true;
 
+  struct token *tokens =
+      arena_alloc(&cmd_arena, sizeof(struct token) * (len + 1));
+  int token_count = tokenize(buf, len, tokens);
+  if (token_count < 0) {
+    printf("-%s: syntax error: unterminated quote\n", sysname);
+    command->name = "";
+    return 1;
+  }
 
-void func_cut(char **currinput) {
-   
-       	char curr_delimiter = '\t'; //def tab
-   
-       	char *stringfield = NULL;
-
-    //parsing the input for d and f
-    for (int x = 1; currinput[x] != NULL; x++) {
-       
-	    if (strncmp(currinput[x], "-d", 2) == 0) {// delimiter 
-           
-		    if (strlen(currinput[x]) > 2) {
-               
-			    curr_delimiter  = currinput[x][2]; //handling input for -d:
-            }
-	
-		    else if (currinput[x+1] != NULL) {
-               
-		 	     curr_delimiter  = currinput[x+1][0]; //handling input for -d ":"
-                
-			    x++;
-            }
-        }
-       
-    	    else if (strncmp(currinput[x], "-f", 2) == 0) { //fields 
-           
-	       	if (strlen(currinput[x]) > 2) {
-               
-		       	stringfield = currinput[x] + 2; //handling input for -f1,6
-            }
-	       	else if (currinput[x+1] != NULL) {
-               
-		       
-		       	stringfield = currinput[x+1];   //handling input for -f 1,6
-              
-		      	 x++;
-            }
-        }
+  int index = 0;
+  struct command_t *pipeline = command; // head of the current pipeline
+  struct command_t *c = command;
+  while (index < token_count) {
+    // count words of the stage first so args is allocated once
+    int words = 0;
+    for (int j = index; tokens[j].type == TOK_WORD ||
+                        tokens[j].type == TOK_IN || tokens[j].type == TOK_OUT ||
+                        tokens[j].type == TOK_APPEND;
+         j++) {
+      if (tokens[j].type != TOK_WORD && tokens[j + 1].type == TOK_WORD)
+        j++; // redirect target
+      else
+        words++;
     }
+    if (words == 0)
+      goto syntax_error;
 
-    if (!stringfield) {
-       
-	    fprintf(stderr, "f field dont specified\n");
-       
-	    return;
-    }
-
-    //parsing comma separated field indexes
-    int currfield[100];
-   
-    int cnt = 0;
-   
-    char *stringf = strdup(stringfield);
-   
-    char *currtoken = strtok(stringf, ",");
-    
-    while (currtoken != NULL && cnt < 100) {
-       
-	     currfield[cnt++] = atoi(currtoken);
-       
-	    currtoken = strtok(NULL, ",");
-    }
-   
-    free(stringf);
-
-    //processing stdin row by row 
-    char thisrow[4096];
-   
-    while (fgets(thisrow, sizeof(thisrow), stdin)) {
-       
-	 thisrow[strcspn(thisrow, "\n")] = 0; //cutting trailing newline
-
-        
-         char *fieldparsed[1000]; //splitting string by delimiter
-       
-       	int countparsed = 1;
-        
-       	fieldparsed[countparsed] = thisrow;
-        
-         int length = strlen(thisrow);
-       
-       	for (int x = 0; x < length; x++) {
-           
-	      	if (thisrow[x] == curr_delimiter ) {
-              
-		       	thisrow[x] = '\0'; //nullterminating at delimiter
-                
-		         countparsed++;
-               
-	 	       	fieldparsed[countparsed] = &thisrow[x + 1];
-            }
-        }
-
-        //printing in fields in order
-        int beginning = 1;
-       
-       	for (int i = 0; i < cnt; i++) {
-           
-	       	int indexf = currfield[i];
-            
-            //if field exist in curr line
-            if (indexf > 0 && indexf <= countparsed) {
-               
-		    if (!beginning){
-			   
-			    printf("%c", curr_delimiter);
-               }
-		    printf("%s", fieldparsed[indexf]);
-               
-		    beginning = 0;
-            }
+    c->args = arena_alloc(&cmd_arena, sizeof(char *) * (words + 1));
+    int arg_index = 0;
+    while (1) {
+      int type = tokens[index].type;
+      if (type == TOK_WORD) {
+        c->args[arg_index++] = tokens[index++].text;
+      } else if (type == TOK_IN || type == TOK_OUT || type == TOK_APPEND) {
+        if (tokens[index + 1].type != TOK_WORD) {
+          index++;
+          goto syntax_error;
         }
-        printf("\n");
+        int redirect_index = type == TOK_IN ? 0 : type == TOK_OUT ? 1 : 2;
+        c->redirects[redirect_index] = tokens[index + 1].text;
+        index += 2;
+      } else
+        break;
     }
-}
-
+    // args[0] is the name and args[arg_count-1] (last) is NULL
+    c->name = c->args[0];
+    c->args[arg_index] = NULL;
+    c->arg_count = arg_index + 1;
 
+    int op = tokens[index].type;
+    if (op == TOK_END)
+      break;
+    index++;
 
-void chat_func(char **inputs) {
-   
-      	if (inputs[1] == NULL || inputs[2] == NULL) {
-       
-	       	printf("chatroom <roomname> <username>\n");
-       		 return;
-    }
-
-    char *room = inputs[1];
-   
-    char *user = inputs[2];
-   
-    char directory_room[256];
-   
-    char pipe_user[512];
-
-    //room folder creation
-   
-    snprintf(directory_room, sizeof(directory_room), "/tmp/chatroom-%s", room);
-   
-    mkdir(directory_room, 0777); 
-
-    //creating user pipe
-   
-    snprintf(pipe_user, sizeof(pipe_user), "%s/%s", directory_room, user);
-   
-    mkfifo(pipe_user, 0666); 
-
-    printf("entered room  %s\n", room);
-
-    pid_t pid_rc = fork();
-  
-    if (pid_rc == 0) {
-       
-	 //continously read receiver process
-        
-        int descriptor = open(pipe_user, O_RDWR); 
-       
-       	char bufferybuff[1024];
-       
-       	while (1) {
-            
-		int x = read(descriptor, bufferybuff, sizeof(bufferybuff) - 1);
-           
-	       	if (x > 0) {
-               
-		       	bufferybuff[x] = '\0';
-               
-		       	//clearing current line
-               		 printf("\r");
-		       
-		       	printf("                                                                                                                           ");
-               	 
-		         printf("\r[%s] %s\n", room, bufferybuff);
-		       
-			//prompt printing
-		       	printf("[%s] %s > ", room, user);
-		       	fflush(stdout);
-            }
-        }
-        exit(0);
-    }
-   
-    else {
-        //process for sender
-       
- 	 char curr_message[1024];
-       
-	 char message_new[2048];
-        
-        while (1) {
-           
-	       	printf("[%s] %s > ", room, user);
-           
-	       	fflush(stdout);
-            
-            if (fgets(curr_message, sizeof(curr_message), stdin) == NULL){
-		    break;
-	    }
-	    //trimming newline
-            curr_message[strcspn(curr_message, "\n")] = '\0';
-            
-            if (strcmp(curr_message, "\\quit") == 0){
-		    break; //for exiting
-			   }
-            if (strlen(curr_message) == 0){
-		    continue; }
-
-            snprintf(message_new, sizeof(message_new), "%s: %s", user, curr_message);
-
-            // Iterate over all named pipes within the room's folder 
-           
-	    DIR *thisdir = opendir(directory_room);
-           
-	    if (thisdir) {
-               
-		    struct dirent *curr_dir;
-               
-		    while ((curr_dir = readdir(thisdir)) != NULL) {
-                   
-			    //dont write to . and .. and own pipe
-                            if (strcmp((*curr_dir).d_name, ".") != 0 && strcmp((*curr_dir).d_name, "..") != 0 &&  strcmp((*curr_dir).d_name, user) != 0) {
-                        
-                       		 //writing to all other pipes
-                       		 pid_t pid_sd = fork();
-                       
-			     if (pid_sd == 0) {
-                                 
-				     char pipe_trg[512];
-                                  
-				     snprintf(pipe_trg, sizeof(pipe_trg), "%s/%s", directory_room, curr_dir->d_name);
-                            
-                           	 //non blocking for operating under crash
-                            	
-				     int descout = open(pipe_trg, O_WRONLY | O_NONBLOCK);
-                           
-				     if (descout >= 0) {
-                               
-					   write(descout, message_new, strlen(message_new));
-                               		    close(descout);
-                            }
-                            exit(0);
-                        }
-			     else {
-                            
-				     waitpid(pid_sd, NULL, 0);
-                        }
-                    }
-                }
-                closedir(thisdir);
-            }
-        }
-        
-        //quitting
-        kill(pid_rc, SIGTERM);
-       
-       	waitpid(pid_rc, NULL, 0);
-       
-       	unlink(pipe_user);
+    // piping to another command
+    if (op == TOK_PIPE) {
+      if (tokens[index].type != TOK_WORD && tokens[index].type != TOK_IN &&
+          tokens[index].type != TOK_OUT && tokens[index].type != TOK_APPEND)
+        goto syntax_error;
+      c->next = arena_alloc(&cmd_arena, sizeof(struct command_t));
+      c = c->next;
+      continue;
     }
-}
 
+    // background process
+    if (op == TOK_AMP)
+      for (struct command_t *s = pipeline; s; s = s->next)
+        s->background = true;
 
-
-void reminder(char **inputs) {
-   
-       	if (inputs[1] == NULL || inputs[2] == NULL) {
-       
-	       	printf("remind <seconds> <message...>\n");
-       
-	       	return;
-    }
-
-    int time = atoi(inputs[1]);
-   
-    if (time <= 0) {
-        printf("seconds should be positive\n");
-        return;
-    }
-
-    //reconstructing the message
-    char this_message[1024] = "";
-   
-    for (int x = 2; inputs[x] != NULL; x++) {
-        
-	    strncat(this_message, inputs[x], sizeof(this_message) - strlen(this_message) - 1);
-       
-	    if (inputs[x+1] != NULL) {
-           
-		    strncat(this_message, " ", sizeof(this_message) - strlen(this_message) - 1);
-        }
+    if (op == TOK_AND || op == TOK_OR) {
+      if (tokens[index].type == TOK_END)
+        goto syntax_error;
+      pipeline->list_op = op == TOK_AND ? LIST_AND : LIST_OR;
     }
+    if (tokens[index].type == TOK_END)
+      break;
 
-    // Fork a background process for the timer
-   
-    pid_t reminder_pid = fork();
-   
-    if (reminder_pid < 0) {
-        perror("fork failed");
-        return;
-    }
+    pipeline->next_list = arena_alloc(&cmd_arena, sizeof(struct command_t));
+    pipeline = c = pipeline->next_list;
+  }
 
-    if (reminder_pid == 0) {
-      
-        sleep(time);
-        
-        // \a activates bell \n \r moves to new line without interfering the users current prompt 
-        printf("\n\r\a[REMINDER] %s\n", this_message);
-        
-        exit(0);
+  if (!command->name)
+    command->name = ""; // empty line
+  return 0;
 
-    }
-    else {
-        //parent: print reminder and return
-        printf("[Reminder set for %d seconds from now (PID: %d)]\n", time, reminder_pid);
-    }
+syntax_error:
+  printf("-%s: syntax error near unexpected token `%s'\n", sysname,
+         tokens[index].type == TOK_WORD ? tokens[index].text
+                                        : token_names[tokens[index].type]);
+  bool auto_complete = command->auto_complete;
+  memset(command, 0, sizeof(struct command_t));
+  command->auto_complete = auto_complete;
+  command->name = "";
+  return 1;
 }
 
+//output batched into large write() calls, fd -1 keeps it in memory
+#define OUT_BUFFER_SIZE (256 * 1024)
 
+struct out_buffer {
+  int fd;
+  char *data;
+  size_t len;
+  size_t cap;
+};
 
-
-//struct for process info
-struct processes {
-    int pid;
-    int parentid;
-    char name[256];
-};
-
-
-//helper for recursive printing
-void tree_helper(struct processes *process, int count, int p_pid, int depth) {
-   
-       	for (int x = 0; x < count; x++) {
-       
-	       	if (process[x].parentid == p_pid) {
-           
-		       	
-           		//indentation based on depth
-		       	for (int j = 0; j < depth; j++) {
-               
-			       	printf("  ");
-            	}
-           
-		       	if (depth > 0){
-		   
-		   
-			       	printf("|- ");
-	   	 }
-            printf("%s [%d]\n", process[x].name, process[x].pid);
-            
-            //recursively print childs
-	tree_helper(process, count, process[x].pid, depth + 1);
-        }
+static void out_flush(struct out_buffer *out) {
+  size_t done = 0;
+  while (done < out->len) {
+    ssize_t w = write(out->fd, out->data + done, out->len - done);
+    if (w < 0) {
+      if (errno == EINTR)
+        continue;
+      break; // reader went away, drop the rest
     }
+    done += w;
+  }
+  out->len = 0;
 }
 
-
-void pstree(char **inputs) {
-   
-       	DIR *curr = opendir("/proc");
-   
-       	if (!curr) {
-       
-	       	perror("cant open proc");
-       
-	       	return;
-    }
-
-    int cap = 1024;
-   
-    struct processes *process = malloc(sizeof(struct processes) * cap);
-   
-    int count = 0;
-
-    struct dirent *directory;
-    
-    //iterate through proc except non numeric
-   
-    while ((directory = readdir(curr)) != NULL) {
-        
-        if (!isdigit((*directory).d_name[0])){
-	       
-		continue;
-    }
-        int curr_pid = atoi((*directory).d_name);
-       
-       	char filepath[256];
-       
-       	snprintf(filepath, sizeof(filepath), "/proc/%d/stat", curr_pid);
-
-        //opening stat file
-        FILE *curr_file = fopen(filepath, "r");
-       
-       	if (curr_file) {
-            int parent_pid;
-            char proc_name[256];
-            
-            
-            
-            //parsing the stat file and grabbing the name
-            if (fscanf(curr_file, "%*d (%[^)]) %*c %d", proc_name, &parent_pid) == 2) {
-                
-                //expanding array if necessary
-                if (count >= cap) {
-                    
-			cap *= 2;
-                   
-		       	process = realloc(process, sizeof(struct processes) * cap);
-                }
-                
-                process[count].pid =curr_pid;
-                process[count].parentid = parent_pid;
-                strncpy(process[count].name, proc_name, 255);
-                count++;
-            }
-            fclose(curr_file);
-        }
+static void out_append(struct out_buffer *out, const char *p, size_t n) {
+  if (out->len + n > out->cap && out->fd < 0) {
+    while (out->len + n > out->cap)
+      out->cap = out->cap ? out->cap * 2 : OUT_BUFFER_SIZE;
+    out->data = realloc(out->data, out->cap);
+  }
+  if (out->len + n > out->cap) {
+    out_flush(out);
+    if (n > out->cap) { // bigger than the whole buffer, skip the copy
+      struct out_buffer direct = {out->fd, (char *)p, n, n};
+      out_flush(&direct);
+      return;
     }
-    closedir(curr);
-
-    //print from root
-    printf("System Process Tree:\n");
-    tree_helper(process, count, 0, 0);
-
-    free(process);
+  }
+  memcpy(out->data + out->len, p, n);
+  out->len += n;
 }
 
+//command history: the file from earlier sessions is mapped and only split
+//into lines as far back as it is browsed, this session's lines are kept in
+//memory. Position 0 is the newest line.
+#define HISTORY_SESSION 1024  // lines kept from this session
+#define HISTORY_BLOCK 32      // file lines per trigram posting
+#define TRIGRAM_BUCKETS 65536
 
+struct trigram_posting {
+  uint32_t *blocks; // ascending block numbers holding the trigram
+  uint32_t count;
+  uint32_t cap;
+};
 
+static struct {
+  int fd; // appends, -1 without a history file
+  const char *map;
+  size_t map_len;
+  size_t *starts;    // start of file line r, r = 0 is the newest
+  size_t found;      // file lines located so far
+  size_t scan_end;   // everything before this offset is not split yet
+  size_t cap;
+  char *session[HISTORY_SESSION]; // oldest first, the oldest drops out
+  int session_count;
+  struct trigram_posting *index; // over file lines, built on first search
+} history = {.fd = -1};
 
+/**
+ * Open the history file for appending and map what is already there
+ * @param path [description]
+ */
+void history_load(const char *path) {
+  history.fd = open(path, O_RDWR | O_CREAT | O_APPEND | O_CLOEXEC, 0600);
+  if (history.fd < 0)
+    return;
+  struct stat st;
+  if (fstat(history.fd, &st) < 0 || st.st_size == 0)
+    return;
+  void *map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, history.fd, 0);
+  if (map == MAP_FAILED)
+    return;
+  history.map = map;
+  history.map_len = history.scan_end = st.st_size;
+}
 
-int process_command(struct command_t *command) {
-  int r;
-  if (strcmp(command->name, "") == 0)
-    return SUCCESS;
-
-  if (strcmp(command->name, "exit") == 0)
-    return EXIT;
-
-  if (strcmp(command->name, "cd") == 0) {
-    if (command->arg_count > 0) {
-      r = chdir(command->args[1]);
-      if (r == -1)
-        printf("-%s: %s: %s\n", sysname, command->name, strerror(errno));
-      return SUCCESS;
+// locate the next older file line, false once the file is exhausted
+static bool history_scan_one() {
+  while (history.scan_end > 0) {
+    size_t end = history.scan_end; // just past the line's newline
+    if (history.map[end - 1] == '\n')
+      end--;
+    const char *nl = end > 0 ? memrchr(history.map, '\n', end) : NULL;
+    size_t start = nl ? (size_t)(nl - history.map) + 1 : 0;
+    history.scan_end = start;
+    if (start == end)
+      continue; // empty line
+    if (history.found == history.cap) {
+      history.cap = history.cap ? history.cap * 2 : 1024;
+      history.starts = realloc(history.starts, sizeof(size_t) * history.cap);
     }
+    history.starts[history.found++] = start;
+    return true;
   }
+  return false;
+}
 
-  
-  if (command->next) {
-   
-	  int fdpiping[2];
-  
-	  if (pipe(fdpiping) < 0) {
-     
-		  perror("fail to pipe");
-    
-		  return SUCCESS;
-    }
-
-    pid_t newpid = fork();
-    if (newpid == 0) {
-      // pipe's left side
-      dup2(fdpiping[1], STDOUT_FILENO);
-     
-      close(fdpiping[0]);
-     
-      close(fdpiping[1]);
-      
-      
-      command->next = NULL; //severing the chain
-      process_command(command); //executing left side recursive
-      exit(SUCCESS);
-    }
-
-  
-    pid_t pidnew2 = fork();
-  
-    if (pidnew2 == 0) {
-      //reading right side of pipe
-     
-	    dup2(fdpiping[0], STDIN_FILENO);
-     
-	    close(fdpiping[0]);
-     
-	    close(fdpiping[1]);
-      
-     
-	    process_command(command->next); //executing rest of chain
-     
-	    exit(SUCCESS);
-    }
-
-    //parent close pipe
-    close(fdpiping[0]);
-   
-    close(fdpiping[1]);
-
-    if (command->background) {
-     
-	    printf("[%d] work in background", newpid);
-     
-	    printf("[%d] work in background", pidnew2);
-    }
-    else {
-     	
-	    waitpid(newpid, NULL, 0);
-     	
-	    waitpid(pidnew2, NULL, 0);
-    }
-    return SUCCESS;
+/**
+ * Line at a position, newest first
+ * @param  pos [description]
+ * @param  len set to its length, it is not null terminated
+ * @return     the line, NULL past the oldest one
+ */
+const char *history_get(long pos, size_t *len) {
+  if (pos < 0)
+    return NULL;
+  if (pos < history.session_count) {
+    const char *line = history.session[history.session_count - 1 - pos];
+    *len = strlen(line);
+    return line;
   }
+  size_t r = pos - history.session_count;
+  while (history.found <= r)
+    if (!history_scan_one())
+      return NULL;
+  size_t start = history.starts[r];
+  const char *nl = memchr(history.map + start, '\n', history.map_len - start);
+  *len = (nl ? (size_t)(nl - history.map) : history.map_len) - start;
+  return history.map + start;
+}
 
+/**
+ * Remember an entered line, skipping blank ones and repeats
+ * @param line [description]
+ */
+void history_add(const char *line) {
+  if (line[strspn(line, " \t")] == '\0')
+    return;
+  size_t len;
+  const char *newest = history_get(0, &len);
+  if (newest && len == strlen(line) && memcmp(newest, line, len) == 0)
+    return;
+
+  // an older copy in this session moves to the front instead
+  for (int i = 0; i < history.session_count; i++) {
+    if (strcmp(history.session[i], line) == 0) {
+      free(history.session[i]);
+      memmove(&history.session[i], &history.session[i + 1],
+              sizeof(char *) * (history.session_count - i - 1));
+      history.session_count--;
+      break;
+    }
+  }
+  if (history.session_count == HISTORY_SESSION) {
+    free(history.session[0]);
+    memmove(&history.session[0], &history.session[1],
+            sizeof(char *) * (HISTORY_SESSION - 1));
+    history.session_count--;
+  }
+  history.session[history.session_count++] = strdup(line);
 
-  pid_t pid = fork();
-  if (pid == 0) // child
-  {
-    /// This shows how to do exec with environ (but is not available on MacOs)
-    // extern char** environ; // environment variables
-    // execvpe(command->name, command->args, environ); // exec+args+path+environ
+  if (history.fd >= 0) { // one write, so shells sharing the file don't mix
+    size_t n = strlen(line);
+    char *record = malloc(n + 1);
+    memcpy(record, line, n);
+    record[n] = '\n';
+    write(history.fd, record, n + 1);
+    free(record);
+  }
+}
 
-    /// This shows how to do exec with auto-path resolve
-    // add a NULL argument to the end of args, and the name to the beginning
-    // as required by exec
+static inline uint32_t trigram_bucket(const char *p) {
+  uint32_t t = (unsigned char)p[0] << 16 | (unsigned char)p[1] << 8 |
+               (unsigned char)p[2];
+  return (t * 2654435761u) >> 16;
+}
 
-    // TODO: do your own exec with path resolving using execv()
-    // do so by replacing the execvp call below
-    if (command->redirects[0]) {
-     //for input red'rect'on
-	 int inputfd = open(command->redirects[0], O_RDONLY);
-     
-      if (inputfd < 0) {
-       
-	      perror("Input file cannot open");
-       
-	      exit(EXIT_FAILURE);
-      }
-     
-      dup2(inputfd, STDIN_FILENO); 
-      close(inputfd);
-    }
-    if (command->redirects[1]) {
-     // for output direction
-	 int outputfd = open(command->redirects[1], O_WRONLY | O_CREAT | O_TRUNC, 0666);
-     
-      if (outputfd < 0) {
-       
- 	 perror("output file cannot opened");
-         exit(EXIT_FAILURE);
+//split the whole file and record which blocks of lines hold each trigram
+static void history_build_index() {
+  while (history_scan_one())
+    ;
+  history.index = calloc(TRIGRAM_BUCKETS, sizeof(struct trigram_posting));
+  for (size_t r = 0; r < history.found; r++) {
+    uint32_t block = r / HISTORY_BLOCK;
+    size_t len;
+    const char *line = history_get(history.session_count + r, &len);
+    for (size_t i = 0; i + 3 <= len; i++) {
+      struct trigram_posting *post = &history.index[trigram_bucket(line + i)];
+      if (post->count > 0 && post->blocks[post->count - 1] == block)
+        continue;
+      if (post->count == post->cap) {
+        post->cap = post->cap ? post->cap * 2 : 4;
+        post->blocks = realloc(post->blocks, sizeof(uint32_t) * post->cap);
       }
-     
-      dup2(outputfd, STDOUT_FILENO); 
-     
-      close(outputfd);
-    }
-   if (command->redirects[2]) {
-	//for appending
-	   int appendingfd = open(command->redirects[2], O_WRONLY | O_CREAT | O_APPEND, 0666);
-     	
-	   if (appendingfd < 0) {
-       		
-		 perror("append file cant open");
-       		 exit(EXIT_FAILURE);
-      }
-      dup2(appendingfd, STDOUT_FILENO);
-      close(appendingfd);
+      post->blocks[post->count++] = block;
     }
+  }
+}
 
+static bool posting_has(const struct trigram_posting *post, uint32_t block) {
+  uint32_t lo = 0, hi = post->count;
+  while (lo < hi) {
+    uint32_t mid = (lo + hi) / 2;
+    if (post->blocks[mid] < block)
+      lo = mid + 1;
+    else
+      hi = mid;
+  }
+  return lo < post->count && post->blocks[lo] == block;
+}
 
-    if (strcmp(command->name, "cut") == 0) {
-     
-	    func_cut(command->args);
-    
-	    exit(SUCCESS);
-    }
+static bool history_matches(long pos, const char *query, size_t query_len) {
+  size_t len;
+  const char *line = history_get(pos, &len);
+  return line && memmem(line, len, query, query_len) != NULL;
+}
 
-    if (strcmp(command->name, "chatroom") == 0) {
-     
-	    chat_func(command->args);
-     
-	    exit(SUCCESS);
-    }
+/**
+ * Newest line at or after a position that contains the query. File lines
+ * are only checked in blocks that hold every trigram of the query.
+ * @param  query [description]
+ * @param  from  first position to look at
+ * @return       position of the match, -1 if there is none
+ */
+long history_search(const char *query, long from) {
+  size_t query_len = strlen(query);
+  if (query_len == 0)
+    return -1;
+  for (long pos = from; pos < history.session_count; pos++)
+    if (history_matches(pos, query, query_len))
+      return pos;
 
-    if (strcmp(command->name, "remind") == 0) {
-   
-	    reminder(command->args);
-   
-	    return SUCCESS;
+  if (!history.index)
+    history_build_index();
+  size_t r = from > history.session_count ? from - history.session_count : 0;
+  if (query_len < 3) { // no trigram to narrow it down
+    for (; r < history.found; r++)
+      if (history_matches(history.session_count + r, query, query_len))
+        return history.session_count + r;
+    return -1;
   }
 
-    if (strcmp(command->name, "pstree") == 0) {
-     
-	    pstree(command->args);
-     
-	    exit(SUCCESS);
-    }
+  // walk the rarest trigram's blocks, the others filter them
+  const struct trigram_posting *rarest = NULL;
+  for (size_t i = 0; i + 3 <= query_len; i++) {
+    const struct trigram_posting *post =
+        &history.index[trigram_bucket(query + i)];
+    if (!rarest || post->count < rarest->count)
+      rarest = post;
+  }
+  uint32_t lo = 0, hi = rarest->count, first = r / HISTORY_BLOCK;
+  while (lo < hi) {
+    uint32_t mid = (lo + hi) / 2;
+    if (rarest->blocks[mid] < first)
+      lo = mid + 1;
+    else
+      hi = mid;
+  }
+  for (uint32_t k = lo; k < rarest->count; k++) {
+    uint32_t block = rarest->blocks[k];
+    bool candidate = true;
+    for (size_t i = 0; i + 3 <= query_len && candidate; i++)
+      candidate = posting_has(&history.index[trigram_bucket(query + i)], block);
+    if (!candidate)
+      continue;
+    size_t end = (size_t)(block + 1) * HISTORY_BLOCK;
+    for (size_t j = (size_t)block * HISTORY_BLOCK > r ? (size_t)block * HISTORY_BLOCK : r;
+         j < end && j < history.found; j++)
+      if (history_matches(history.session_count + j, query, query_len))
+        return history.session_count + j;
+  }
+  return -1;
+}
 
+//line editor: the line lives in a gap buffer whose gap is the cursor
+#define GAP_INITIAL_SIZE 256
 
+struct gap_buffer {
+  char *data;
+  size_t cap;
+  size_t gap_start; // also the cursor
+  size_t gap_end;
+};
 
-    char *currpath = path_resolver(command->name);
-    execv(currpath, command->args);
+static size_t gap_length(const struct gap_buffer *gb) {
+  return gb->cap - (gb->gap_end - gb->gap_start);
+}
 
-    
-    printf("-%s: %s: command not found\n", sysname, command->name);
-    exit(127);
-  } else {
-    // TODO: implement background processes here
-    if (command->background) {
-      
-      printf("[%d] started in background\n", pid);
-    }
-    else {
-      // waiting for child
-      waitpid(pid, NULL, 0); 
-    }
-    return SUCCESS;
+static char gap_at(const struct gap_buffer *gb, size_t i) {
+  return i < gb->gap_start ? gb->data[i]
+                           : gb->data[i + gb->gap_end - gb->gap_start];
+}
+
+static void gap_move(struct gap_buffer *gb, size_t pos) {
+  if (pos < gb->gap_start) {
+    size_t n = gb->gap_start - pos;
+    memmove(gb->data + gb->gap_end - n, gb->data + pos, n);
+    gb->gap_start -= n;
+    gb->gap_end -= n;
+  } else if (pos > gb->gap_start) {
+    size_t n = pos - gb->gap_start;
+    memmove(gb->data + gb->gap_start, gb->data + gb->gap_end, n);
+    gb->gap_start += n;
+    gb->gap_end += n;
   }
 }
 
-int main() {
-  while (1) {
-    struct command_t *command =
-        (struct command_t *)malloc(sizeof(struct command_t));
-    memset(command, 0, sizeof(struct command_t)); // set all bytes to 0
+static void gap_insert(struct gap_buffer *gb, const char *text, size_t n) {
+  if (gb->gap_end - gb->gap_start < n) {
+    size_t after = gb->cap - gb->gap_end;
+    size_t cap = (gb->cap + n) * 2 + 64;
+    gb->data = realloc(gb->data, cap);
+    memmove(gb->data + cap - after, gb->data + gb->gap_end, after);
+    gb->gap_end = cap - after;
+    gb->cap = cap;
+  }
+  memcpy(gb->data + gb->gap_start, text, n);
+  gb->gap_start += n;
+}
 
-    int code;
-    code = prompt(command);
-    if (code == EXIT)
-      break;
+//removes [from, to)
+static void gap_delete(struct gap_buffer *gb, size_t from, size_t to) {
+  gap_move(gb, from);
+  gb->gap_end += to - from;
+}
 
-    code = process_command(command);
+static void gap_set(struct gap_buffer *gb, const char *text) {
+  if (!gb->data) { // first use, the copies below never see a null buffer
+    gb->cap = GAP_INITIAL_SIZE;
+    gb->data = malloc(gb->cap);
+  }
+  gb->gap_start = 0;
+  gb->gap_end = gb->cap;
+  gap_insert(gb, text, strlen(text));
+}
+
+//the line as one null terminated string
+static char *gap_text(const struct gap_buffer *gb) {
+  size_t len = gap_length(gb);
+  char *text = malloc(len + 1);
+  memcpy(text, gb->data, gb->gap_start);
+  memcpy(text + gb->gap_start, gb->data + gb->gap_end, gb->cap - gb->gap_end);
+  text[len] = '\0';
+  return text;
+}
+
+//keys decoded from escape sequences, above any byte value
+enum editor_keys {
+  KEY_UP = 1000,
+  KEY_DOWN,
+  KEY_LEFT,
+  KEY_RIGHT,
+  KEY_HOME,
+  KEY_END,
+  KEY_DELETE,
+  KEY_WORD_LEFT,
+  KEY_WORD_RIGHT,
+  KEY_WORD_RUBOUT,
+  KEY_IGNORED,
+};
+
+struct line_editor {
+  struct gap_buffer line;
+  size_t dirty;        // first byte changed since the last refresh
+  int prompt_width;
+  int width;           // terminal columns
+  size_t shown_column; // where the terminal cursor is, counted from the prompt
+  size_t shown_end;    // column after the last byte on screen
+  char *edited;        // the typed line while history is shown
+  long history_pos;    // shown history line, -1 while editing
+  struct out_buffer out;
+};
+
+static bool utf8_continuation(char c) { return (c & 0xc0) == 0x80; }
+
+// column of byte i, counted from the start of the prompt line
+static size_t editor_column(const struct line_editor *ed, size_t i) {
+  size_t column = ed->prompt_width;
+  for (size_t j = 0; j < i; j++)
+    if (!utf8_continuation(gap_at(&ed->line, j)))
+      column++;
+  return column;
+}
+
+static void editor_printf(struct line_editor *ed, const char *fmt, int n) {
+  char seq[32];
+  int len = snprintf(seq, sizeof(seq), fmt, n);
+  out_append(&ed->out, seq, len);
+}
+
+static void editor_move(struct line_editor *ed, size_t from, size_t to) {
+  if (from == to)
+    return;
+  int rows = (int)(to / ed->width) - (int)(from / ed->width);
+  if (rows < 0)
+    editor_printf(ed, "\033[%dA", -rows);
+  else if (rows > 0)
+    editor_printf(ed, "\033[%dB", rows);
+  out_append(&ed->out, "\r", 1);
+  if (to % ed->width)
+    editor_printf(ed, "\033[%dC", to % ed->width);
+}
+
+/**
+ * Bring the screen up to date with one write: rewrite from the first
+ * changed byte, clear what the old line left behind, put the cursor back
+ * @param ed [description]
+ */
+void editor_refresh(struct line_editor *ed) {
+  size_t len = gap_length(&ed->line);
+  if (ed->dirty != SIZE_MAX) {
+    size_t from = ed->dirty < len ? ed->dirty : len;
+    size_t from_column = editor_column(ed, from);
+    editor_move(ed, ed->shown_column, from_column);
+    for (size_t i = from; i < len; i++) {
+      char c = gap_at(&ed->line, i);
+      out_append(&ed->out, &c, 1);
+    }
+    size_t end = from_column;
+    for (size_t i = from; i < len; i++)
+      if (!utf8_continuation(gap_at(&ed->line, i)))
+        end++;
+    if (len > from && end % ed->width == 0)
+      out_append(&ed->out, "\r\n", 2); // leave the pending wrap state
+    if (ed->shown_end > end)
+      out_append(&ed->out, "\033[J", 3);
+    ed->shown_column = ed->shown_end = end;
+    ed->dirty = SIZE_MAX;
+  }
+  size_t cursor = editor_column(ed, ed->line.gap_start);
+  editor_move(ed, ed->shown_column, cursor);
+  ed->shown_column = cursor;
+
+  struct out_buffer screen = ed->out;
+  screen.fd = STDOUT_FILENO;
+  out_flush(&screen);
+  ed->out.len = 0;
+}
+
+//show a fresh prompt with the whole line below whatever was printed
+static void editor_redraw(struct line_editor *ed) {
+  show_prompt();
+  ed->prompt_width = prompt_cache.width;
+  ed->shown_column = ed->shown_end = ed->prompt_width;
+  ed->dirty = 0;
+  editor_refresh(ed);
+}
+
+static void editor_changed(struct line_editor *ed, size_t from) {
+  if (from < ed->dirty)
+    ed->dirty = from;
+}
+
+static void editor_replace(struct line_editor *ed, const char *text) {
+  gap_set(&ed->line, text);
+  editor_changed(ed, 0);
+}
+
+//show a history line, or the typed one again for -1
+static void editor_show_history(struct line_editor *ed, long pos) {
+  if (pos < 0) {
+    editor_replace(ed, ed->edited ? ed->edited : "");
+  } else {
+    size_t len;
+    const char *line = history_get(pos, &len);
+    gap_set(&ed->line, "");
+    gap_insert(&ed->line, line, len);
+    editor_changed(ed, 0);
+  }
+  ed->history_pos = pos;
+}
+
+// next history position from pos in a direction, skipping repeats of what
+// is on screen
+static long editor_history_step(struct line_editor *ed, long pos, int step) {
+  char *shown = gap_text(&ed->line);
+  size_t shown_len = strlen(shown), len;
+  const char *line;
+  for (pos += step; (line = history_get(pos, &len)) != NULL; pos += step)
+    if (len != shown_len || memcmp(line, shown, len) != 0)
+      break;
+  free(shown);
+  return line ? pos : -1;
+}
+
+int editor_read_key(struct line_editor *ed);
+
+/**
+ * Ctrl+R: search the history as the query is typed, Ctrl+R again goes to
+ * older matches, Enter runs the match, Ctrl+G or Ctrl+C give the old line
+ * back and any other key keeps the match for editing
+ * @return the key that ended the search, handled by the caller
+ */
+int editor_search(struct line_editor *ed) {
+  char query[256] = "";
+  size_t query_len = 0;
+  long match = -1;
+  char *before = gap_text(&ed->line);
+  int key;
+  while (1) {
+    // the search line takes the prompt's place, cut to the screen width
+    editor_move(ed, ed->shown_column, 0);
+    out_append(&ed->out, "\r\033[J", 4);
+    char head[320];
+    int head_len = snprintf(head, sizeof(head), "(%sreverse-i-search)`%s': ",
+                            query_len > 0 && match < 0 ? "failed " : "", query);
+    size_t room = ed->width > 1 ? ed->width - 1 : 1;
+    size_t used = (size_t)head_len < room ? (size_t)head_len : room;
+    out_append(&ed->out, head, used);
+    size_t len = 0;
+    const char *line = match >= 0 ? history_get(match, &len) : NULL;
+    if (line)
+      out_append(&ed->out, line, len < room - used ? len : room - used);
+    struct out_buffer screen = ed->out;
+    screen.fd = STDOUT_FILENO;
+    out_flush(&screen);
+    ed->out.len = 0;
+    ed->shown_column = 0; // editor_move only needs the row, which is the first
+
+    key = editor_read_key(ed);
+    if (key == CTRL('r')) {
+      if (match >= 0) {
+        long older = history_search(query, match + 1);
+        if (older >= 0)
+          match = older;
+      }
+    } else if (key == 127 || key == CTRL('h')) {
+      if (query_len > 0)
+        query[--query_len] = '\0';
+      match = history_search(query, 0);
+    } else if (key >= ' ' && key < 256 && query_len < sizeof(query) - 1) {
+      query[query_len++] = key;
+      query[query_len] = '\0';
+      match = history_search(query, match >= 0 ? match : 0);
+    } else {
+      break;
+    }
+  }
+
+  out_append(&ed->out, "\r\033[J", 4);
+  if (key == CTRL('g') || key == CTRL('c') || match < 0) {
+    editor_replace(ed, before);
+  } else {
+    editor_show_history(ed, match);
+    gap_move(&ed->line, gap_length(&ed->line));
+  }
+  free(before);
+  struct out_buffer screen = ed->out;
+  screen.fd = STDOUT_FILENO;
+  out_flush(&screen);
+  ed->out.len = 0;
+  editor_redraw(ed);
+  return key == CTRL('g') || key == CTRL('c') ? KEY_IGNORED : key;
+}
+
+static size_t editor_word_left(const struct gap_buffer *gb, size_t pos) {
+  while (pos > 0 && isspace((unsigned char)gap_at(gb, pos - 1)))
+    pos--;
+  while (pos > 0 && !isspace((unsigned char)gap_at(gb, pos - 1)))
+    pos--;
+  return pos;
+}
+
+static size_t editor_word_right(const struct gap_buffer *gb, size_t pos) {
+  size_t len = gap_length(gb);
+  while (pos < len && isspace((unsigned char)gap_at(gb, pos)))
+    pos++;
+  while (pos < len && !isspace((unsigned char)gap_at(gb, pos)))
+    pos++;
+  return pos;
+}
+
+static struct termios editor_cooked;
+static bool editor_has_cooked = false, editor_raw = false;
+
+/**
+ * Put the terminal in the editor's mode, only if it is not already there
+ */
+void editor_raw_mode() {
+  if (editor_raw)
+    return;
+  if (!editor_has_cooked) { // once per session
+    if (tcgetattr(STDIN_FILENO, &editor_cooked) < 0)
+      return;
+    editor_has_cooked = true;
+  }
+  struct termios raw = editor_cooked;
+  // no line discipline, echo or signal keys, the editor handles them all
+  raw.c_lflag &= ~(ICANON | ECHO | ISIG | IEXTEN);
+  raw.c_cc[VMIN] = 1;
+  raw.c_cc[VTIME] = 0;
+  tcsetattr(STDIN_FILENO, TCSADRAIN, &raw);
+  editor_raw = true;
+}
+
+/**
+ * Give commands back the normal terminal
+ */
+void editor_cooked_mode() {
+  if (!editor_raw)
+    return;
+  tcsetattr(STDIN_FILENO, TCSADRAIN, &editor_cooked);
+  editor_raw = false;
+}
+
+int reminder_fd();
+int reminders_fire();
+void reminders_sync();
+int jobs_sigchld_fd();
+void jobs_reap();
+int jobs_notify();
+
+/**
+ * Read one byte for the prompt, printing reminders and finished jobs that
+ * come up meanwhile
+ * @param  ed      line being edited, redrawn after a notification
+ * @param  timeout in ms, -1 to wait for input
+ * @return         the byte, 4 (Ctrl+D) at end of input, -1 on timeout
+ */
+int prompt_getchar(struct line_editor *ed, int timeout) {
+  fflush(stdout);
+  while (1) {
+    // a negative fd is skipped by poll
+    struct pollfd fds[3] = {{STDIN_FILENO, POLLIN, 0},
+                            {reminder_fd(), POLLIN, 0},
+                            {jobs_sigchld_fd(), POLLIN, 0}};
+    int ready = poll(fds, 3, timeout);
+    if (ready < 0) {
+      if (errno == EINTR)
+        continue;
+      return 4;
+    }
+    if (ready == 0)
+      return -1;
+    int shown = 0;
+    if (fds[1].revents & POLLIN)
+      shown += reminders_fire();
+    if (fds[2].revents & POLLIN) {
+      // background jobs are reaped as soon as they finish
+      jobs_reap();
+      shown += jobs_notify();
+    }
+    if (shown > 0)
+      editor_redraw(ed);
+    if (fds[0].revents & (POLLIN | POLLHUP | POLLERR)) {
+      unsigned char c;
+      ssize_t r = read(STDIN_FILENO, &c, 1);
+      if (r < 0 && errno == EINTR)
+        continue;
+      return r == 1 ? c : 4;
+    }
+  }
+}
+
+/**
+ * Read a key, decoding the escape sequences of arrows, home, end, delete
+ * and their ctrl/alt word variants
+ * @return a byte or one of editor_keys
+ */
+int editor_read_key(struct line_editor *ed) {
+  int c = prompt_getchar(ed, -1);
+  if (c != 27)
+    return c;
+
+  // a lone escape is not followed by anything right away
+  int next = prompt_getchar(ed, 50);
+  if (next == 'b')
+    return KEY_WORD_LEFT; // alt+b
+  if (next == 'f')
+    return KEY_WORD_RIGHT; // alt+f
+  if (next == 127)
+    return KEY_WORD_RUBOUT; // alt+backspace
+  if (next != '[' && next != 'O')
+    return KEY_IGNORED;
+
+  // CSI: numeric parameters separated by ';' then a final byte
+  int params[2] = {0, 0}, count = 0, final;
+  while (1) {
+    final = prompt_getchar(ed, 50);
+    if (final < 0)
+      return KEY_IGNORED;
+    if (isdigit(final)) {
+      if (count < 2)
+        params[count] = params[count] * 10 + (final - '0');
+    } else if (final == ';') {
+      count++;
+    } else if (final >= 0x40 && final <= 0x7e) {
+      break;
+    }
+  }
+  bool word = count > 0 && (params[1] == 3 || params[1] == 5); // alt, ctrl
+  switch (final) {
+  case 'A': return KEY_UP;
+  case 'B': return KEY_DOWN;
+  case 'C': return word ? KEY_WORD_RIGHT : KEY_RIGHT;
+  case 'D': return word ? KEY_WORD_LEFT : KEY_LEFT;
+  case 'H': return KEY_HOME;
+  case 'F': return KEY_END;
+  case '~':
+    if (params[0] == 1 || params[0] == 7)
+      return KEY_HOME;
+    if (params[0] == 4 || params[0] == 8)
+      return KEY_END;
+    if (params[0] == 3)
+      return KEY_DELETE;
+  }
+  return KEY_IGNORED;
+}
+
+/**
+ * Prompt a command from the user
+ * @param  command filled with the parsed line
+ * @return         EXIT on Ctrl+D at an empty line, SUCCESS otherwise
+ */
+int prompt(struct command_t *command) {
+  static struct line_editor ed; // buffers are kept between prompts
+  struct gap_buffer *line = &ed.line;
+
+  editor_raw_mode();
+  struct winsize ws;
+  ed.width = ioctl(STDOUT_FILENO, TIOCGWINSZ, &ws) == 0 && ws.ws_col > 0
+                 ? ws.ws_col
+                 : 80;
+  gap_set(line, "");
+  free(ed.edited);
+  ed.edited = NULL;
+  ed.history_pos = -1;
+  reminders_sync(); // pick up reminders other shells set
+  editor_redraw(&ed);
+
+  while (1) {
+    int c = editor_read_key(&ed);
+    if (c == CTRL('r'))
+      c = editor_search(&ed);
+    size_t cursor = line->gap_start, len = gap_length(line);
+
+    if (c == '\n' || c == '\r') // enter key
+      break;
+
+    if (c == '\t') { // autocomplete
+      gap_move(line, len);
+      gap_insert(line, "?", 1);
+      editor_changed(&ed, len);
+      break;
+    }
+
+    switch (c) {
+    case 4: // Ctrl+D, quits on an empty line
+      if (len == 0) {
+        out_append(&ed.out, "\n", 1);
+        editor_refresh(&ed);
+        return EXIT;
+      }
+      // fall through
+    case KEY_DELETE:
+      if (cursor < len) {
+        size_t end = cursor + 1;
+        while (end < len && utf8_continuation(gap_at(line, end)))
+          end++;
+        gap_delete(line, cursor, end);
+        editor_changed(&ed, cursor);
+      }
+      break;
+    case 127: // backspace
+    case CTRL('h'):
+      if (cursor > 0) {
+        size_t start = cursor - 1;
+        while (start > 0 && utf8_continuation(gap_at(line, start)))
+          start--;
+        gap_delete(line, start, cursor);
+        editor_changed(&ed, start);
+      }
+      break;
+    case KEY_LEFT:
+    case CTRL('b'):
+      while (cursor > 0 && utf8_continuation(gap_at(line, --cursor)))
+        ;
+      gap_move(line, cursor);
+      break;
+    case KEY_RIGHT:
+    case CTRL('f'):
+      if (cursor < len)
+        cursor++;
+      while (cursor < len && utf8_continuation(gap_at(line, cursor)))
+        cursor++;
+      gap_move(line, cursor);
+      break;
+    case KEY_HOME:
+    case CTRL('a'):
+      gap_move(line, 0);
+      break;
+    case KEY_END:
+    case CTRL('e'):
+      gap_move(line, len);
+      break;
+    case KEY_WORD_LEFT:
+      gap_move(line, editor_word_left(line, cursor));
+      break;
+    case KEY_WORD_RIGHT:
+      gap_move(line, editor_word_right(line, cursor));
+      break;
+    case CTRL('w'):
+    case KEY_WORD_RUBOUT: {
+      size_t start = editor_word_left(line, cursor);
+      gap_delete(line, start, cursor);
+      editor_changed(&ed, start);
+      break;
+    }
+    case CTRL('u'): // kill to the start
+      gap_delete(line, 0, cursor);
+      editor_changed(&ed, 0);
+      break;
+    case CTRL('k'): // kill to the end
+      gap_delete(line, cursor, len);
+      editor_changed(&ed, cursor);
+      break;
+    case CTRL('l'):
+      out_append(&ed.out, "\033[H\033[2J", 7);
+      editor_refresh(&ed);
+      editor_redraw(&ed);
+      break;
+    case CTRL('c'): // drop the line
+      gap_move(line, len);
+      editor_refresh(&ed);
+      out_append(&ed.out, "^C\n", 3);
+      editor_refresh(&ed);
+      gap_set(line, "");
+      editor_redraw(&ed);
+      break;
+    case KEY_UP:
+    case CTRL('p'): {
+      long older = editor_history_step(&ed, ed.history_pos, 1);
+      if (older < 0)
+        break;
+      if (ed.history_pos < 0) {
+        free(ed.edited);
+        ed.edited = gap_text(line);
+      }
+      editor_show_history(&ed, older);
+      break;
+    }
+    case KEY_DOWN:
+    case CTRL('n'):
+      if (ed.history_pos >= 0)
+        editor_show_history(&ed,
+                            editor_history_step(&ed, ed.history_pos, -1));
+      break;
+    default:
+      if (c >= ' ' && c < 256 && c != 127) { // printable and utf-8 bytes
+        char byte = c;
+        gap_insert(line, &byte, 1);
+        editor_changed(&ed, cursor);
+      }
+    }
+    editor_refresh(&ed);
+  }
+
+  // leave the cursor after the line
+  gap_move(line, gap_length(line));
+  editor_refresh(&ed);
+  out_append(&ed.out, "\n", 1);
+  editor_refresh(&ed);
+
+  char *buf = gap_text(line);
+  history_add(buf);
+
+  parse_command(buf, command);
+  free(buf); // words were copied into the arena
+
+  // print_command(command); // DEBUG: uncomment for debugging
+  return SUCCESS;
+}
+
+//non-interactive input, read in large blocks and split into lines
+#define BATCH_BLOCK_SIZE (64 * 1024)
+
+struct batch_input {
+  int fd;          // -1 when everything is already in data
+  char *data;
+  size_t len, pos; // valid bytes and start of the next line
+  size_t cap;
+};
+
+/**
+ * Next line of the input, newline stripped and null terminated in place
+ * @param  in [description]
+ * @return    the line, NULL at end of input
+ */
+char *batch_next_line(struct batch_input *in) {
+  while (1) {
+    char *start = in->data + in->pos;
+    char *newline = memchr(start, '\n', in->len - in->pos);
+    if (newline) {
+      *newline = '\0';
+      in->pos = newline - in->data + 1;
+      return start;
+    }
+    if (in->fd < 0) { // last line without a newline
+      if (in->pos == in->len)
+        return NULL;
+      in->data[in->len] = '\0';
+      in->pos = in->len;
+      return start;
+    }
+
+    // keep the partial line and read the next block behind it
+    memmove(in->data, start, in->len - in->pos);
+    in->len -= in->pos;
+    in->pos = 0;
+    if (in->cap - in->len < BATCH_BLOCK_SIZE + 1) {
+      in->cap = in->cap * 2 + BATCH_BLOCK_SIZE + 1;
+      in->data = realloc(in->data, in->cap);
+    }
+    ssize_t r = read(in->fd, in->data + in->len, BATCH_BLOCK_SIZE);
+    if (r < 0 && errno == EINTR)
+      continue;
+    if (r <= 0)
+      in->fd = -1;
+    else
+      in->len += r;
+  }
+}
+
+//hashed command lookup, name -> resolved path
+#define HASH_BUCKETS 256
+
+struct hash_entry {
+  char *name;
+  char *path;
+  unsigned long hits;
+  struct hash_entry *next;
+};
+
+static struct hash_entry *hash_table[HASH_BUCKETS];
+static char *hash_path_env = NULL; // PATH the table was filled from
+static unsigned long hash_hits = 0, hash_misses = 0;
+
+static unsigned int hash_string(const char *str) {
+  unsigned int h = 5381;
+  while (*str)
+    h = h * 33 + (unsigned char)*str++;
+  return h % HASH_BUCKETS;
+}
+
+/**
+ * Drop every entry of the command hash table
+ */
+void hash_clear() {
+  for (int i = 0; i < HASH_BUCKETS; i++) {
+    struct hash_entry *e = hash_table[i];
+    while (e) {
+      struct hash_entry *next = e->next;
+      free(e->name);
+      free(e->path);
+      free(e);
+      e = next;
+    }
+    hash_table[i] = NULL;
+  }
+}
+
+/**
+ * Clear the table if PATH changed since it was filled
+ */
+static void hash_check_path() {
+  const char *enviroment_path = getenv("PATH");
+  if (!enviroment_path)
+    enviroment_path = "";
+  if (hash_path_env && strcmp(hash_path_env, enviroment_path) == 0)
+    return;
+  hash_clear();
+  free(hash_path_env);
+  hash_path_env = strdup(enviroment_path);
+}
+
+static struct hash_entry **hash_find(const char *name) {
+  struct hash_entry **e = &hash_table[hash_string(name)];
+  while (*e && strcmp((*e)->name, name) != 0)
+    e = &(*e)->next;
+  return e;
+}
+
+/**
+ * Insert or replace the cached path of a command
+ */
+void hash_insert(const char *name, const char *path) {
+  struct hash_entry **slot = hash_find(name);
+  if (*slot) {
+    free((*slot)->path);
+    (*slot)->path = strdup(path);
+    (*slot)->hits = 0;
+    return;
+  }
+  struct hash_entry *e = malloc(sizeof(struct hash_entry));
+  e->name = strdup(name);
+  e->path = strdup(path);
+  e->hits = 0;
+  e->next = NULL;
+  *slot = e;
+}
+
+/**
+ * Search PATH for an executable, without touching the cache
+ * @return malloc'd path or NULL
+ */
+static char *path_search(const char *command) {
+  char *enviroment_path = getenv("PATH");
+  if (!enviroment_path)
+    return NULL;
+
+  // copy path
+  char *copyp = strdup(enviroment_path);
+  char *directory = strtok(copyp, ":");
+  char buffybuffer[1024];
+
+  // looping for path
+  while (directory != NULL) {
+    snprintf(buffybuffer, sizeof(buffybuffer), "%s/%s", directory, command);
+
+    // checking for execution
+    if (access(buffybuffer, X_OK) == 0) {
+      free(copyp);
+      return strdup(buffybuffer);
+    }
+    directory = strtok(NULL, ":"); //next directory
+  }
+
+  free(copyp);
+  return NULL;
+}
+
+char *path_resolver(char *command) {
+  //command has a slash we return its copy
+  if (strchr(command, '/'))
+    return strdup(command);
+
+  hash_check_path();
+
+  struct hash_entry **slot = hash_find(command);
+  if (*slot) {
+    // a cached path may have been removed or lost its x bit
+    if (access((*slot)->path, X_OK) == 0) {
+      (*slot)->hits++;
+      hash_hits++;
+      return strdup((*slot)->path);
+    }
+    struct hash_entry *stale = *slot;
+    *slot = stale->next;
+    free(stale->name);
+    free(stale->path);
+    free(stale);
+  }
+
+  hash_misses++;
+  char *found = path_search(command);
+  if (!found)
+    return strdup(command); //back to original command
+
+  hash_insert(command, found);
+  return found;
+}
+
+/**
+ * hash builtin
+ * hash             list cached commands and hit/miss counters
+ * hash -r          forget every cached command
+ * hash -p path cmd use path for cmd
+ * hash cmd...      look up cmds and remember them
+ */
+void hash_func(char **inputs) {
+  hash_check_path();
+
+  if (inputs[1] == NULL) {
+    int empty = 1;
+    for (int i = 0; i < HASH_BUCKETS; i++) {
+      for (struct hash_entry *e = hash_table[i]; e; e = e->next) {
+        if (empty)
+          printf("hits\tcommand\n");
+        empty = 0;
+        printf("%4lu\t%s\n", e->hits, e->path);
+      }
+    }
+    if (empty)
+      printf("hash: hash table empty\n");
+    printf("hash: %lu hits, %lu misses\n", hash_hits, hash_misses);
+    return;
+  }
+
+  if (strcmp(inputs[1], "-r") == 0) {
+    hash_clear();
+    hash_hits = hash_misses = 0;
+    return;
+  }
+
+  if (strcmp(inputs[1], "-p") == 0) {
+    if (inputs[2] == NULL || inputs[3] == NULL) {
+      printf("hash -p <path> <command>\n");
+      return;
+    }
+    hash_insert(inputs[3], inputs[2]);
+    return;
+  }
+
+  for (int x = 1; inputs[x] != NULL; x++) {
+    if (strchr(inputs[x], '/'))
+      continue;
+    char *found = path_search(inputs[x]);
+    if (!found) {
+      printf("-%s: hash: %s: not found\n", sysname, inputs[x]);
+      continue;
+    }
+    hash_insert(inputs[x], found);
+    free(found);
+  }
+}
+
+// set by Ctrl+C while a builtin runs inside the shell, long loops check it
+static volatile sig_atomic_t builtin_interrupted = 0;
+
+//delimiter search used by cut, picked once by cpu features
+typedef const char *(*delim_finder)(const char *, const char *, char);
+
+static const char *find_delim_scalar(const char *p, const char *end,
+                                     char delim) {
+  // libc memchr is already word-at-a-time on most targets
+  return memchr(p, delim, end - p);
+}
+
+#if defined(__x86_64__) || defined(__i386__)
+__attribute__((target("sse2"))) static const char *
+find_delim_sse2(const char *p, const char *end, char delim) {
+  __m128i needle = _mm_set1_epi8(delim);
+  while (end - p >= 16) {
+    __m128i chunk = _mm_loadu_si128((const __m128i *)p);
+    int mask = _mm_movemask_epi8(_mm_cmpeq_epi8(chunk, needle));
+    if (mask)
+      return p + __builtin_ctz(mask);
+    p += 16;
+  }
+  for (; p < end; p++)
+    if (*p == delim)
+      return p;
+  return NULL;
+}
+
+__attribute__((target("avx2"))) static const char *
+find_delim_avx2(const char *p, const char *end, char delim) {
+  __m256i needle = _mm256_set1_epi8(delim);
+  while (end - p >= 32) {
+    __m256i chunk = _mm256_loadu_si256((const __m256i *)p);
+    unsigned mask = _mm256_movemask_epi8(_mm256_cmpeq_epi8(chunk, needle));
+    if (mask)
+      return p + __builtin_ctz(mask);
+    p += 32;
+  }
+  return find_delim_sse2(p, end, delim);
+}
+#endif
+
+static delim_finder pick_delim_finder() {
+#if defined(__x86_64__) || defined(__i386__)
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("avx2"))
+    return find_delim_avx2;
+  if (__builtin_cpu_supports("sse2"))
+    return find_delim_sse2;
+#endif
+  return find_delim_scalar;
+}
+
+#define CUT_BLOCK_SIZE (256 * 1024)
+
+enum cut_modes {
+  CUT_FIELDS = 0, // -f
+  CUT_BYTES,      // -b and -c, characters are taken as bytes
+};
+
+//parsed options of one cut invocation
+struct cut_spec {
+  int mode;
+  char delimiter;
+  const char *output_delimiter;
+  size_t output_delimiter_len;
+  bool explicit_output_delimiter; // --output-delimiter given
+  bool only_delimited;            // -s
+  // selected[i] tells if field/byte i (1 based) is printed, for i <= last
+  unsigned char *selected;
+  int last;
+  bool tail_selected; // whether everything after last is printed
+  delim_finder find_delim;
+};
+
+static inline bool cut_selected(const struct cut_spec *spec, long i) {
+  return i <= spec->last ? spec->selected[i] : spec->tail_selected;
+}
+
+/**
+ * Cut one line, without its newline, into out
+ * @param spec     [description]
+ * @param line     [description]
+ * @param line_end [description]
+ * @param out      [description]
+ */
+static void cut_line(const struct cut_spec *spec, const char *line,
+                     const char *line_end, struct out_buffer *out) {
+  bool printed = false;
+
+  if (spec->mode == CUT_BYTES) {
+    // emit runs of selected bytes, tail runs go out in one piece
+    long len = line_end - line;
+    long i = 1;
+    while (i <= len) {
+      if (!cut_selected(spec, i)) {
+        i++;
+        continue;
+      }
+      long j = i;
+      if (i > spec->last)
+        j = len;
+      else
+        while (j < len && j < spec->last && spec->selected[j + 1])
+          j++;
+      if (j == spec->last && spec->tail_selected)
+        j = len;
+      if (printed && spec->explicit_output_delimiter)
+        out_append(out, spec->output_delimiter, spec->output_delimiter_len);
+      out_append(out, line + i - 1, j - i + 1);
+      printed = true;
+      i = j + 1;
+    }
+    out_append(out, "\n", 1);
+    return;
+  }
+
+  const char *d = spec->find_delim(line, line_end, spec->delimiter);
+  if (!d) { // no delimiter at all, the line passes unless -s
+    if (!spec->only_delimited) {
+      out_append(out, line, line_end - line);
+      out_append(out, "\n", 1);
+    }
+    return;
+  }
+
+  //walking fields, stopping after the last one that can be printed
+  const char *p = line;
+  for (long field = 1;; field++) {
+    const char *field_end = d ? d : line_end;
+    if (cut_selected(spec, field)) {
+      if (printed)
+        out_append(out, spec->output_delimiter, spec->output_delimiter_len);
+      out_append(out, p, field_end - p);
+      printed = true;
+    }
+    if (!d || (field >= spec->last && !spec->tail_selected))
+      break;
+    p = d + 1;
+    d = spec->find_delim(p, line_end, spec->delimiter);
+  }
+  out_append(out, "\n", 1);
+}
+
+/**
+ * Compile a list like 1,3-5,7- into spec->selected
+ * @return 0, or -1 with a message on a bad list
+ */
+static int cut_compile_list(struct cut_spec *spec, const char *list,
+                            bool complement) {
+  int count = 1;
+  for (const char *c = list; *c; c++)
+    if (*c == ',')
+      count++;
+  long *lo = malloc(sizeof(long) * count);
+  long *hi = malloc(sizeof(long) * count); // 0 means open ended
+
+  int n = 0;
+  long last = 0;
+  long open_from = 0;
+  const char *p = list;
+  while (1) {
+    char *endp;
+    long a = 1, b;
+    if (*p != '-') {
+      a = strtol(p, &endp, 10);
+      if (endp == p)
+        goto bad_list;
+      p = endp;
+    }
+    b = a;
+    if (*p == '-') {
+      p++;
+      if (*p == ',' || *p == 0)
+        b = 0;
+      else {
+        b = strtol(p, &endp, 10);
+        if (endp == p)
+          goto bad_list;
+        p = endp;
+      }
+    }
+    if (a < 1 || (b != 0 && b < 1)) {
+      fprintf(stderr, "cut: fields and positions are numbered from 1\n");
+      goto fail;
+    }
+    if (b != 0 && b < a) {
+      fprintf(stderr, "cut: invalid decreasing range\n");
+      goto fail;
+    }
+    lo[n] = a;
+    hi[n] = b;
+    n++;
+    if ((b ? b : a) > last)
+      last = b ? b : a;
+    if (b == 0 && (open_from == 0 || a < open_from))
+      open_from = a;
+    if (*p == 0)
+      break;
+    if (*p != ',')
+      goto bad_list;
+    p++;
+  }
+
+  if (last > 10000000) {
+    fprintf(stderr, "cut: field number too large\n");
+    goto fail;
+  }
+  spec->last = last;
+  spec->selected = calloc(last + 1, 1);
+  for (int i = 0; i < n; i++)
+    for (long j = lo[i]; j <= (hi[i] ? hi[i] : last); j++)
+      spec->selected[j] = 1;
+  spec->tail_selected = open_from != 0;
+  if (complement) {
+    for (long j = 1; j <= last; j++)
+      spec->selected[j] = !spec->selected[j];
+    spec->tail_selected = !spec->tail_selected;
+  }
+  free(lo);
+  free(hi);
+  return 0;
+
+bad_list:
+  fprintf(stderr, "cut: invalid list: %s\n", list);
+fail:
+  free(lo);
+  free(hi);
+  return -1;
+}
+
+/**
+ * Cut every line of a memory range into out
+ */
+static void cut_range(const struct cut_spec *spec, const char *p,
+                      const char *end, struct out_buffer *out) {
+  const char *nl;
+  while ((nl = spec->find_delim(p, end, '\n')) != NULL) {
+    cut_line(spec, p, nl, out);
+    p = nl + 1;
+  }
+  if (p < end) // last line without newline
+    cut_line(spec, p, end, out);
+}
+
+/**
+ * Cut a stream read() in big blocks, a partial last line is carried over
+ */
+static void cut_stream(const struct cut_spec *spec, int fd,
+                       struct out_buffer *out) {
+  size_t cap = CUT_BLOCK_SIZE;
+  char *block = malloc(cap);
+  size_t carry = 0;
+  while (1) {
+    if (carry == cap) { // one line longer than the block, grow it
+      cap *= 2;
+      block = realloc(block, cap);
+    }
+    ssize_t r = read(fd, block + carry, cap - carry);
+    if (builtin_interrupted)
+      break;
+    if (r < 0 && errno == EINTR)
+      continue;
+    if (r <= 0)
+      break;
+
+    const char *p = block;
+    const char *end = block + carry + r;
+    const char *nl;
+    while ((nl = spec->find_delim(p, end, '\n')) != NULL) {
+      cut_line(spec, p, nl, out);
+      p = nl + 1;
+    }
+    carry = end - p;
+    memmove(block, p, carry);
+    out_flush(out); // a pipe or terminal sees each line as it arrives
+  }
+  if (carry > 0) // last line without newline
+    cut_line(spec, block, block + carry, out);
+  free(block);
+}
+
+#define CUT_CHUNK_SIZE (4 * 1024 * 1024)
+#define CUT_MAX_WORKERS 64
+
+//a mapped file cut by a pool of threads, written back in chunk order
+struct cut_job {
+  const struct cut_spec *spec;
+  const char *data;
+  size_t size;
+  int chunk_count;
+  int window;      // chunks that may be finished but not yet written
+  int next_chunk;  // next chunk a worker picks up
+  int written;     // chunks already written out
+  struct out_buffer *results; // one per window slot
+  bool *done;
+  pthread_mutex_t lock;
+  pthread_cond_t cond;
+};
+
+// chunk i starts at the first line beginning at or after i * CUT_CHUNK_SIZE
+static size_t chunk_boundary(const struct cut_job *job, int i) {
+  size_t p = (size_t)i * CUT_CHUNK_SIZE;
+  if (i == 0)
+    return 0;
+  if (p >= job->size)
+    return job->size;
+  const char *nl = memchr(job->data + p - 1, '\n', job->size - p + 1);
+  return nl ? (size_t)(nl - job->data) + 1 : job->size;
+}
+
+static void *cut_worker(void *arg) {
+  struct cut_job *job = arg;
+  pthread_mutex_lock(&job->lock);
+  while (job->next_chunk < job->chunk_count) {
+    int i = job->next_chunk;
+    if (i >= job->written + job->window) { // writer is behind, wait
+      pthread_cond_wait(&job->cond, &job->lock);
+      continue;
+    }
+    job->next_chunk++;
+    pthread_mutex_unlock(&job->lock);
+
+    struct out_buffer *out = &job->results[i % job->window];
+    out->len = 0;
+    cut_range(job->spec, job->data + chunk_boundary(job, i),
+              job->data + chunk_boundary(job, i + 1), out);
+
+    pthread_mutex_lock(&job->lock);
+    job->done[i % job->window] = true;
+    pthread_cond_broadcast(&job->cond);
+  }
+  pthread_mutex_unlock(&job->lock);
+  return NULL;
+}
+
+/**
+ * Cut a regular file through mmap, on several threads when it is big
+ * @return 0, or -1 if it could not be mapped
+ */
+static int cut_mapped(const struct cut_spec *spec, int fd,
+                      struct out_buffer *out) {
+  struct stat st;
+  if (fstat(fd, &st) < 0 || !S_ISREG(st.st_mode))
+    return -1;
+  off_t offset = lseek(fd, 0, SEEK_CUR); // honour what was already read
+  if (offset < 0 || offset > st.st_size)
+    offset = 0;
+  size_t size = st.st_size;
+  if (size == 0)
+    return 0;
+  char *data = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+  if (data == MAP_FAILED)
+    return -1;
+  madvise(data, size, MADV_SEQUENTIAL);
+
+  struct cut_job job = {0};
+  job.spec = spec;
+  job.data = data + offset;
+  job.size = size - offset;
+  job.chunk_count = (job.size + CUT_CHUNK_SIZE - 1) / CUT_CHUNK_SIZE;
+
+  long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+  int workers = cpus < 1 ? 1 : cpus > CUT_MAX_WORKERS ? CUT_MAX_WORKERS : cpus;
+  if (workers > job.chunk_count)
+    workers = job.chunk_count;
+
+  if (workers <= 1) {
+    cut_range(spec, job.data, job.data + job.size, out);
+  } else {
+    out_flush(out);
+    job.window = workers * 2;
+    job.results = calloc(job.window, sizeof(struct out_buffer));
+    job.done = calloc(job.window, sizeof(bool));
+    for (int i = 0; i < job.window; i++)
+      job.results[i].fd = -1;
+    pthread_mutex_init(&job.lock, NULL);
+    pthread_cond_init(&job.cond, NULL);
+
+    pthread_t threads[CUT_MAX_WORKERS];
+    int started = 0;
+    for (; started < workers; started++)
+      if (pthread_create(&threads[started], NULL, cut_worker, &job) != 0)
+        break;
+
+    if (started == 0) {
+      cut_range(spec, job.data, job.data + job.size, out);
+    } else {
+      // write chunks back in order while the workers keep going
+      pthread_mutex_lock(&job.lock);
+      for (int i = 0; i < job.chunk_count; i++) {
+        if (builtin_interrupted && job.chunk_count > job.next_chunk)
+          job.chunk_count = job.next_chunk; // hand out no more chunks
+        int slot = i % job.window;
+        while (!job.done[slot])
+          pthread_cond_wait(&job.cond, &job.lock);
+        pthread_mutex_unlock(&job.lock);
+
+        struct out_buffer chunk = job.results[slot];
+        chunk.fd = out->fd;
+        if (!builtin_interrupted)
+          out_flush(&chunk);
+
+        pthread_mutex_lock(&job.lock);
+        job.done[slot] = false;
+        job.written++;
+        pthread_cond_broadcast(&job.cond);
+      }
+      pthread_mutex_unlock(&job.lock);
+    }
+
+    for (int i = 0; i < started; i++)
+      pthread_join(threads[i], NULL);
+    for (int i = 0; i < job.window; i++)
+      free(job.results[i].data);
+    free(job.results);
+    free(job.done);
+    pthread_mutex_destroy(&job.lock);
+    pthread_cond_destroy(&job.cond);
+  }
+
+  munmap(data, size);
+  return 0;
+}
+
+/**
+ * cut builtin
+ * cut -f LIST [-d DELIM] [-s] [--complement] [--output-delimiter=STR] [FILE...]
+ * cut -b LIST | -c LIST [--complement] [--output-delimiter=STR] [FILE...]
+ * LIST is a comma list of N, N-M, N- and -M
+ */
+void func_cut(char **currinput) {
+  struct cut_spec spec = {0};
+  spec.delimiter = '\t'; //def tab
+  spec.find_delim = pick_delim_finder();
+  char *stringfield = NULL;
+  bool complement = false;
+  int file_count = 0;
+  char **files = malloc(sizeof(char *) * 1);
+
+  //parsing the options
+  for (int x = 1; currinput[x] != NULL; x++) {
+    char *arg = currinput[x];
+    if (arg[0] != '-' || strcmp(arg, "-") == 0) { // file
+      files = realloc(files, sizeof(char *) * (file_count + 1));
+      files[file_count++] = arg;
+    } else if (strcmp(arg, "--complement") == 0) {
+      complement = true;
+    } else if (strcmp(arg, "-s") == 0 ||
+               strcmp(arg, "--only-delimited") == 0) {
+      spec.only_delimited = true;
+    } else if (strncmp(arg, "--output-delimiter", 18) == 0) {
+      if (arg[18] == '=')
+        spec.output_delimiter = arg + 19;
+      else if (arg[18] == 0 && currinput[x + 1] != NULL)
+        spec.output_delimiter = currinput[++x];
+      else {
+        fprintf(stderr, "cut: --output-delimiter needs a string\n");
+        free(files);
+        return;
+      }
+    } else if (arg[1] == 'd') { // delimiter
+      if (strlen(arg) > 2) {
+        spec.delimiter = arg[2]; //handling input for -d:
+      } else if (currinput[x + 1] != NULL) {
+        spec.delimiter = currinput[x + 1][0]; //handling input for -d ":"
+        x++;
+      }
+    } else if (arg[1] == 'f' || arg[1] == 'b' || arg[1] == 'c') {
+      if (stringfield) {
+        fprintf(stderr, "cut: only one type of list may be specified\n");
+        free(files);
+        return;
+      }
+      spec.mode = arg[1] == 'f' ? CUT_FIELDS : CUT_BYTES;
+      if (strlen(arg) > 2) {
+        stringfield = arg + 2; //handling input for -f1,6
+      } else if (currinput[x + 1] != NULL) {
+        stringfield = currinput[x + 1]; //handling input for -f 1,6
+        x++;
+      }
+    } else {
+      fprintf(stderr, "cut: invalid option %s\n", arg);
+      free(files);
+      return;
+    }
+  }
+
+  if (!stringfield) {
+    fprintf(stderr, "you must specify a list of bytes, characters, or fields\n");
+    free(files);
+    return;
+  }
+  if (cut_compile_list(&spec, stringfield, complement) < 0) {
+    free(files);
+    return;
+  }
+
+  spec.explicit_output_delimiter = spec.output_delimiter != NULL;
+  if (!spec.output_delimiter)
+    spec.output_delimiter = &spec.delimiter;
+  spec.output_delimiter_len =
+      spec.explicit_output_delimiter ? strlen(spec.output_delimiter) : 1;
+
+  struct out_buffer out = {STDOUT_FILENO, malloc(CUT_BLOCK_SIZE), 0,
+                           CUT_BLOCK_SIZE};
+
+  // regular files are mapped, anything else is streamed
+  if (file_count == 0) {
+    if (cut_mapped(&spec, STDIN_FILENO, &out) < 0)
+      cut_stream(&spec, STDIN_FILENO, &out);
+  }
+  for (int i = 0; i < file_count; i++) {
+    int fd = strcmp(files[i], "-") == 0 ? STDIN_FILENO
+                                        : open(files[i], O_RDONLY);
+    if (fd < 0) {
+      out_flush(&out);
+      fprintf(stderr, "cut: %s: %s\n", files[i], strerror(errno));
+      continue;
+    }
+    if (cut_mapped(&spec, fd, &out) < 0)
+      cut_stream(&spec, fd, &out);
+    if (fd != STDIN_FILENO)
+      close(fd);
+  }
+  out_flush(&out);
+
+  free(out.data);
+  free(spec.selected);
+  free(files);
+}
+
+
+
+//open fifo of another room member, fd -1 until its reader shows up
+struct chat_peer {
+  char name[256];
+  int fd;
+};
+
+struct chat_peers {
+  struct chat_peer *list;
+  int count;
+  int cap;
+  unsigned long dropped; // messages lost to full fifos
+};
+
+static struct chat_peer *chat_find_peer(struct chat_peers *peers,
+                                        const char *name) {
+  for (int i = 0; i < peers->count; i++)
+    if (strcmp(peers->list[i].name, name) == 0)
+      return &peers->list[i];
+  return NULL;
+}
+
+//non blocking open, fails with ENXIO while nobody reads the fifo
+static void chat_open_peer(const char *directory_room,
+                           struct chat_peer *peer) {
+  char pipe_trg[512];
+  snprintf(pipe_trg, sizeof(pipe_trg), "%s/%s", directory_room, peer->name);
+  peer->fd = open(pipe_trg, O_WRONLY | O_NONBLOCK | O_CLOEXEC);
+}
+
+static void chat_add_peer(struct chat_peers *peers, const char *directory_room,
+                          const char *name) {
+  struct chat_peer *peer = chat_find_peer(peers, name);
+  if (!peer) {
+    if (peers->count == peers->cap) {
+      peers->cap = peers->cap ? peers->cap * 2 : 16;
+      peers->list = realloc(peers->list, sizeof(struct chat_peer) * peers->cap);
+    }
+    peer = &peers->list[peers->count++];
+    snprintf(peer->name, sizeof(peer->name), "%s", name);
+    peer->fd = -1;
+  }
+  if (peer->fd < 0)
+    chat_open_peer(directory_room, peer);
+}
+
+static void chat_remove_peer(struct chat_peers *peers, const char *name) {
+  struct chat_peer *peer = chat_find_peer(peers, name);
+  if (!peer)
+    return;
+  if (peer->fd >= 0)
+    close(peer->fd);
+  *peer = peers->list[--peers->count];
+}
+
+//apply the room directory changes inotify queued since the last call
+static void chat_watch_room(int watch_fd, struct chat_peers *peers,
+                            const char *directory_room, const char *user) {
+  char events[4096]
+      __attribute__((aligned(__alignof__(struct inotify_event))));
+  ssize_t len;
+  while ((len = read(watch_fd, events, sizeof(events))) > 0) {
+    for (char *p = events; p < events + len;) {
+      struct inotify_event *ev = (struct inotify_event *)p;
+      p += sizeof(struct inotify_event) + ev->len;
+      if (ev->len == 0 || strcmp(ev->name, user) == 0)
+        continue;
+      if (ev->mask & (IN_CREATE | IN_MOVED_TO))
+        chat_add_peer(peers, directory_room, ev->name);
+      else if (ev->mask & (IN_DELETE | IN_MOVED_FROM))
+        chat_remove_peer(peers, ev->name);
+    }
+  }
+}
+
+//add every fifo in the room directory
+static void chat_scan_room(struct chat_peers *peers, const char *directory_room,
+                           const char *user) {
+  DIR *thisdir = opendir(directory_room);
+  if (!thisdir)
+    return;
+  struct dirent *curr_dir;
+  while ((curr_dir = readdir(thisdir)) != NULL) {
+    //dont write to . and .. and own pipe
+    if (strcmp(curr_dir->d_name, ".") != 0 &&
+        strcmp(curr_dir->d_name, "..") != 0 &&
+        strcmp(curr_dir->d_name, user) != 0)
+      chat_add_peer(peers, directory_room, curr_dir->d_name);
+  }
+  closedir(thisdir);
+}
+
+/**
+ * Write a message to every cached peer from this process. A full fifo
+ * drops the message for that reader instead of blocking the room.
+ */
+static void chat_broadcast(struct chat_peers *peers, const char *directory_room,
+                           const char *message, size_t len) {
+  for (int i = 0; i < peers->count; i++) {
+    struct chat_peer *peer = &peers->list[i];
+    if (peer->fd < 0) // reader was not there yet, try again
+      chat_open_peer(directory_room, peer);
+    if (peer->fd < 0)
+      continue;
+    if (write(peer->fd, message, len) < 0) {
+      if (errno == EAGAIN) {
+        peers->dropped++;
+      } else { // EPIPE, reader left without removing its fifo
+        close(peer->fd);
+        peer->fd = -1;
+      }
+    }
+  }
+}
+
+/**
+ * Shared memory transport: a room is one ring of fixed size slots mapped by
+ * every member. Writers reserve a sequence number with an atomic add, so one
+ * write reaches every reader, and readers keep their own cursor. Slot seq is
+ * 0 while a writer fills it and sequence + 1 once it is published.
+ */
+#define CHAT_RING_SLOTS 256
+#define CHAT_SLOT_DATA 4080
+#define CHAT_HISTORY 20 // messages replayed to a late joiner
+#define CHAT_RING_MAGIC 0x63686174
+
+struct chat_slot {
+  _Atomic uint64_t seq;
+  uint32_t len;
+  char data[CHAT_SLOT_DATA];
+};
+
+struct chat_ring {
+  _Atomic uint32_t magic;
+  _Atomic uint32_t members;
+  _Atomic uint64_t head;  // next sequence number to hand out
+  _Atomic uint32_t futex; // bumped on every publish, readers sleep on it
+  struct chat_slot slots[CHAT_RING_SLOTS];
+};
+
+static long chat_futex(_Atomic uint32_t *addr, int op, uint32_t val,
+                       const struct timespec *timeout) {
+  return syscall(SYS_futex, (uint32_t *)addr, op, val, timeout, NULL, 0);
+}
+
+/**
+ * Map the ring of a room, creating it on first join
+ * @return the ring or NULL
+ */
+struct chat_ring *chat_ring_open(const char *room) {
+  char shm_name[300];
+  snprintf(shm_name, sizeof(shm_name), "/shellish-chat-%s", room);
+  int fd = shm_open(shm_name, O_RDWR | O_CREAT, 0666);
+  if (fd < 0) {
+    perror("shm_open");
+    return NULL;
+  }
+  // a fresh zero filled ring is already a valid empty ring
+  struct stat st;
+  if (fstat(fd, &st) == 0 && st.st_size < (off_t)sizeof(struct chat_ring))
+    ftruncate(fd, sizeof(struct chat_ring));
+  struct chat_ring *ring = mmap(NULL, sizeof(struct chat_ring),
+                                PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  close(fd);
+  if (ring == MAP_FAILED) {
+    perror("mmap");
+    return NULL;
+  }
+  uint32_t zero = 0;
+  atomic_compare_exchange_strong(&ring->magic, &zero, CHAT_RING_MAGIC);
+  if (atomic_load(&ring->magic) != CHAT_RING_MAGIC) {
+    fprintf(stderr, "chatroom: %s is not a chat ring\n", shm_name);
+    munmap(ring, sizeof(struct chat_ring));
+    return NULL;
+  }
+  atomic_fetch_add(&ring->members, 1);
+  return ring;
+}
+
+void chat_ring_close(struct chat_ring *ring, const char *room) {
+  if (atomic_fetch_sub(&ring->members, 1) == 1) { // last one out
+    char shm_name[300];
+    snprintf(shm_name, sizeof(shm_name), "/shellish-chat-%s", room);
+    shm_unlink(shm_name);
+  }
+  munmap(ring, sizeof(struct chat_ring));
+}
+
+void chat_ring_publish(struct chat_ring *ring, const char *message,
+                       size_t len) {
+  if (len > CHAT_SLOT_DATA)
+    len = CHAT_SLOT_DATA;
+  uint64_t seq = atomic_fetch_add(&ring->head, 1);
+  struct chat_slot *slot = &ring->slots[seq % CHAT_RING_SLOTS];
+  atomic_store_explicit(&slot->seq, 0, memory_order_relaxed);
+  atomic_thread_fence(memory_order_release);
+  memcpy(slot->data, message, len);
+  slot->len = len;
+  atomic_store_explicit(&slot->seq, seq + 1, memory_order_release);
+
+  atomic_fetch_add(&ring->futex, 1);
+  chat_futex(&ring->futex, FUTEX_WAKE, INT32_MAX, NULL);
+}
+
+/**
+ * Copy the message at *cursor if one is published
+ * @param  ring   [description]
+ * @param  cursor this reader's next sequence number, advanced
+ * @param  out    CHAT_SLOT_DATA bytes
+ * @return        length of the message, -1 if there is nothing to read
+ */
+ssize_t chat_ring_try_read(struct chat_ring *ring, uint64_t *cursor,
+                           char *out) {
+  while (1) {
+    uint64_t head = atomic_load(&ring->head);
+    if (head > *cursor + CHAT_RING_SLOTS) // lapped, skip what was overwritten
+      *cursor = head - CHAT_RING_SLOTS;
+    if (*cursor >= head)
+      return -1;
+
+    struct chat_slot *slot = &ring->slots[*cursor % CHAT_RING_SLOTS];
+    uint64_t before = atomic_load_explicit(&slot->seq, memory_order_acquire);
+    if (before > *cursor + 1) { // already reused by a newer message
+      (*cursor)++;
+      continue;
+    }
+    if (before != *cursor + 1) // writer still filling it
+      return -1;
+
+    size_t len = slot->len;
+    if (len > CHAT_SLOT_DATA)
+      len = CHAT_SLOT_DATA;
+    memcpy(out, slot->data, len);
+    atomic_thread_fence(memory_order_acquire);
+    uint64_t after = atomic_load_explicit(&slot->seq, memory_order_relaxed);
+    (*cursor)++;
+    if (after == before)
+      return len;
+    // overwritten while copying, try the next one
+  }
+}
+
+//growable byte buffer that hands out complete lines
+struct line_buffer {
+  char *data;
+  size_t len;
+  size_t cap;
+};
+
+static void line_buffer_append(struct line_buffer *lb, const char *p,
+                               size_t n) {
+  if (lb->len + n > lb->cap) {
+    while (lb->len + n > lb->cap)
+      lb->cap = lb->cap ? lb->cap * 2 : 4096;
+    lb->data = realloc(lb->data, lb->cap);
+  }
+  memcpy(lb->data + lb->len, p, n);
+  lb->len += n;
+}
+
+/**
+ * Take the next complete line out of a line buffer
+ * @param  lb   [description]
+ * @param  pos  read position inside lb, advanced past the line
+ * @param  line set to the line, newline replaced by 0
+ * @return      length of the line or -1 when no full line is left
+ */
+static ssize_t line_buffer_next(struct line_buffer *lb, size_t *pos,
+                                char **line) {
+  char *start = lb->data + *pos;
+  char *nl = memchr(start, '\n', lb->len - *pos);
+  if (!nl)
+    return -1;
+  *nl = 0;
+  *line = start;
+  *pos = nl + 1 - lb->data;
+  return nl - start;
+}
+
+static void line_buffer_consume(struct line_buffer *lb, size_t pos) {
+  memmove(lb->data, lb->data + pos, lb->len - pos);
+  lb->len -= pos;
+}
+
+//state of one chatroom session, both transports share the event loop
+struct chat_session {
+  const char *room;
+  const char *user;
+  bool use_shm;
+  struct out_buffer screen; // terminal output, one write per wakeup
+
+  // fifo transport
+  char directory_room[256];
+  char pipe_user[512];
+  int own_fd;
+  int watch_fd;
+  struct chat_peers peers;
+  struct line_buffer received;
+
+  // shm transport
+  struct chat_ring *ring;
+  uint64_t cursor;
+  int wake_fd; // eventfd the waker thread signals
+  pthread_t waker;
+  _Atomic bool stop;
+};
+
+static void chat_show(struct chat_session *cs, const char *message,
+                      size_t len) {
+  // clear the prompt line, the prompt is redrawn after the batch
+  const char *clear = "\r\033[K[";
+  out_append(&cs->screen, clear, strlen(clear));
+  out_append(&cs->screen, cs->room, strlen(cs->room));
+  out_append(&cs->screen, "] ", 2);
+  out_append(&cs->screen, message, len);
+  out_append(&cs->screen, "\n", 1);
+}
+
+static void chat_draw_prompt(struct chat_session *cs) {
+  out_append(&cs->screen, "[", 1);
+  out_append(&cs->screen, cs->room, strlen(cs->room));
+  out_append(&cs->screen, "] ", 2);
+  out_append(&cs->screen, cs->user, strlen(cs->user));
+  out_append(&cs->screen, " > ", 3);
+  out_flush(&cs->screen);
+}
+
+//turns futex wakeups of the ring into eventfd readiness for epoll
+static void *chat_ring_waker(void *arg) {
+  struct chat_session *cs = arg;
+  uint64_t seen = atomic_load(&cs->ring->head);
+  while (!atomic_load(&cs->stop)) {
+    uint32_t wake = atomic_load(&cs->ring->futex);
+    uint64_t head = atomic_load(&cs->ring->head);
+    if (head != seen) {
+      seen = head;
+      uint64_t one = 1;
+      write(cs->wake_fd, &one, sizeof(one));
+    }
+    struct timespec timeout = {1, 0};
+    chat_futex(&cs->ring->futex, FUTEX_WAIT, wake, &timeout);
+  }
+  return NULL;
+}
+
+static void chat_drain_ring(struct chat_session *cs) {
+  char message[CHAT_SLOT_DATA];
+  size_t user_len = strlen(cs->user);
+  ssize_t len;
+  while ((len = chat_ring_try_read(cs->ring, &cs->cursor, message)) >= 0) {
+    // own messages are already on screen
+    if ((size_t)len > user_len && strncmp(message, cs->user, user_len) == 0 &&
+        message[user_len] == ':')
+      continue;
+    chat_show(cs, message, len);
+  }
+}
+
+static void chat_drain_fifo(struct chat_session *cs) {
+  char chunk[4096];
+  ssize_t r;
+  while ((r = read(cs->own_fd, chunk, sizeof(chunk))) > 0)
+    line_buffer_append(&cs->received, chunk, r);
+
+  // messages are newline framed, a partial one waits for its rest
+  size_t pos = 0;
+  char *line;
+  ssize_t len;
+  while ((len = line_buffer_next(&cs->received, &pos, &line)) >= 0)
+    chat_show(cs, line, len);
+  line_buffer_consume(&cs->received, pos);
+}
+
+static void chat_send(struct chat_session *cs, const char *text) {
+  if (cs->use_shm) {
+    char message_new[CHAT_SLOT_DATA];
+    int len = snprintf(message_new, sizeof(message_new), "%s: %s", cs->user,
+                       text);
+    if (len >= (int)sizeof(message_new))
+      len = sizeof(message_new) - 1;
+    chat_ring_publish(cs->ring, message_new, len);
+    return;
+  }
+
+  // writes up to PIPE_BUF are atomic, so lines never interleave
+  char message_new[PIPE_BUF];
+  int len = snprintf(message_new, sizeof(message_new), "%s: %s\n", cs->user,
+                     text);
+  if (len >= (int)sizeof(message_new)) {
+    len = sizeof(message_new) - 1;
+    message_new[len - 1] = '\n';
+  }
+  if (cs->watch_fd >= 0)
+    chat_watch_room(cs->watch_fd, &cs->peers, cs->directory_room, cs->user);
+  else // no inotify, fall back to rescanning for new members
+    chat_scan_room(&cs->peers, cs->directory_room, cs->user);
+  chat_broadcast(&cs->peers, cs->directory_room, message_new, len);
+}
+
+static int chat_fifo_open(struct chat_session *cs) {
+  //room folder creation
+  snprintf(cs->directory_room, sizeof(cs->directory_room), "/tmp/chatroom-%s",
+           cs->room);
+  mkdir(cs->directory_room, 0777);
+
+  //creating user pipe, opened rdwr so it never reports eof
+  snprintf(cs->pipe_user, sizeof(cs->pipe_user), "%s/%s", cs->directory_room,
+           cs->user);
+  mkfifo(cs->pipe_user, 0666);
+  cs->own_fd = open(cs->pipe_user, O_RDWR | O_NONBLOCK | O_CLOEXEC);
+  if (cs->own_fd < 0) {
+    perror("chatroom");
+    return -1;
+  }
+
+  signal(SIGPIPE, SIG_IGN); // a vanished reader shows up as EPIPE
+  cs->watch_fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+  if (cs->watch_fd >= 0)
+    inotify_add_watch(cs->watch_fd, cs->directory_room,
+                      IN_CREATE | IN_DELETE | IN_MOVED_TO | IN_MOVED_FROM);
+
+  //members already in the room, later joins come through inotify
+  chat_scan_room(&cs->peers, cs->directory_room, cs->user);
+  return 0;
+}
+
+static void chat_fifo_close(struct chat_session *cs) {
+  for (int i = 0; i < cs->peers.count; i++)
+    if (cs->peers.list[i].fd >= 0)
+      close(cs->peers.list[i].fd);
+  free(cs->peers.list);
+  free(cs->received.data);
+  if (cs->watch_fd >= 0)
+    close(cs->watch_fd);
+  close(cs->own_fd);
+  unlink(cs->pipe_user);
+  if (cs->peers.dropped)
+    printf("%lu messages dropped on full pipes\n", cs->peers.dropped);
+}
+
+static int chat_shm_open(struct chat_session *cs) {
+  cs->ring = chat_ring_open(cs->room);
+  if (!cs->ring)
+    return -1;
+  // start a little back in history for late joiners
+  uint64_t head = atomic_load(&cs->ring->head);
+  cs->cursor = head > CHAT_HISTORY ? head - CHAT_HISTORY : 0;
+  cs->wake_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+  if (cs->wake_fd < 0 ||
+      pthread_create(&cs->waker, NULL, chat_ring_waker, cs) != 0) {
+    perror("chatroom");
+    if (cs->wake_fd >= 0)
+      close(cs->wake_fd);
+    chat_ring_close(cs->ring, cs->room);
+    return -1;
+  }
+  return 0;
+}
+
+static void chat_shm_close(struct chat_session *cs) {
+  atomic_store(&cs->stop, true);
+  atomic_fetch_add(&cs->ring->futex, 1);
+  chat_futex(&cs->ring->futex, FUTEX_WAKE, INT32_MAX, NULL);
+  pthread_join(cs->waker, NULL);
+  close(cs->wake_fd);
+  chat_ring_close(cs->ring, cs->room);
+}
+
+/**
+ * Read what is available on stdin and send every complete line
+ * @param redraw set when the prompt has to be drawn again
+ * @return true on \quit or end of input
+ */
+static bool chat_read_stdin(struct chat_session *cs, struct line_buffer *typed,
+                            bool *redraw) {
+  char chunk[4096];
+  ssize_t r = read(STDIN_FILENO, chunk, sizeof(chunk));
+  if (r <= 0)
+    return true;
+  line_buffer_append(typed, chunk, r);
+  size_t pos = 0;
+  char *line;
+  bool quit = false;
+  while (line_buffer_next(typed, &pos, &line) >= 0) {
+    if (strcmp(line, "\\quit") == 0) {
+      quit = true; //for exiting
+      break;
+    }
+    if (line[0] != 0)
+      chat_send(cs, line);
+    *redraw = true;
+  }
+  line_buffer_consume(typed, pos);
+  return quit;
+}
+
+/**
+ * Run a chatroom session in this process: stdin and the transport are
+ * multiplexed with epoll, so no receiver process shares the terminal
+ */
+void chat_session_run(struct chat_session *cs) {
+  int ep = epoll_create1(EPOLL_CLOEXEC);
+  if (ep < 0) {
+    perror("epoll_create1");
+    return;
+  }
+  struct epoll_event ev = {.events = EPOLLIN};
+  ev.data.fd = STDIN_FILENO;
+  // epoll refuses regular files with EPERM, they are always readable, so
+  // such a stdin is read directly on every pass without blocking in epoll
+  bool stdin_polled = epoll_ctl(ep, EPOLL_CTL_ADD, STDIN_FILENO, &ev) == 0;
+  if (!stdin_polled && errno != EPERM) {
+    perror("epoll_ctl");
+    close(ep);
+    return;
+  }
+  ev.data.fd = cs->use_shm ? cs->wake_fd : cs->own_fd;
+  epoll_ctl(ep, EPOLL_CTL_ADD, ev.data.fd, &ev);
+  if (!cs->use_shm && cs->watch_fd >= 0) {
+    ev.data.fd = cs->watch_fd;
+    epoll_ctl(ep, EPOLL_CTL_ADD, cs->watch_fd, &ev);
+  }
+
+  if (cs->use_shm)
+    chat_drain_ring(cs); // history replay
+  chat_draw_prompt(cs);
+
+  struct line_buffer typed = {0};
+  uint64_t stuck_at = UINT64_MAX;
+  bool quit = false;
+  while (!quit) {
+    struct epoll_event events[8];
+    int n = epoll_wait(ep, events, 8,
+                       !stdin_polled ? 0 : cs->use_shm ? 200 : -1);
+    if (builtin_interrupted)
+      break;
+    if (n < 0) {
+      if (errno == EINTR)
+        continue;
+      perror("epoll_wait");
+      break;
+    }
+
+    bool redraw = false;
+    for (int i = 0; i < n && !quit; i++) {
+      int fd = events[i].data.fd;
+      if (fd == STDIN_FILENO) {
+        quit = chat_read_stdin(cs, &typed, &redraw);
+      } else if (fd == cs->watch_fd && !cs->use_shm) {
+        chat_watch_room(cs->watch_fd, &cs->peers, cs->directory_room,
+                        cs->user);
+      } else if (cs->use_shm) {
+        uint64_t count;
+        read(cs->wake_fd, &count, sizeof(count));
+        chat_drain_ring(cs);
+        redraw = true;
+      } else {
+        chat_drain_fifo(cs);
+        redraw = true;
+      }
+    }
+
+    if (cs->use_shm && n == 0) {
+      // a writer that died mid publish would block the cursor forever
+      if (cs->cursor < atomic_load(&cs->ring->head)) {
+        if (stuck_at == cs->cursor)
+          cs->cursor++;
+        stuck_at = cs->cursor;
+        chat_drain_ring(cs);
+        redraw = true;
+      } else
+        stuck_at = UINT64_MAX;
+    }
+    if (!stdin_polled && !quit)
+      quit = chat_read_stdin(cs, &typed, &redraw);
+
+    if (quit)
+      out_flush(&cs->screen);
+    else if (redraw)
+      chat_draw_prompt(cs);
+  }
+
+  free(typed.data);
+  close(ep);
+}
+
+/**
+ * chatroom builtin
+ * chatroom [-s] <roomname> <username>
+ * -s uses the shared memory ring instead of one named pipe per member
+ */
+void chat_func(char **inputs) {
+  bool use_shm = inputs[1] != NULL && strcmp(inputs[1], "-s") == 0;
+  if (use_shm)
+    inputs++;
+  if (inputs[1] == NULL || inputs[2] == NULL) {
+    printf("chatroom [-s] <roomname> <username>\n");
+    return;
+  }
+
+  struct chat_session cs = {0};
+  cs.room = inputs[1];
+  cs.user = inputs[2];
+  cs.use_shm = use_shm;
+  cs.own_fd = cs.watch_fd = cs.wake_fd = -1;
+  cs.screen.fd = STDOUT_FILENO;
+  cs.screen.data = malloc(4096);
+  cs.screen.cap = 4096;
+
+  if ((use_shm ? chat_shm_open(&cs) : chat_fifo_open(&cs)) < 0) {
+    free(cs.screen.data);
+    return;
+  }
+  printf("entered room  %s\n", cs.room);
+  fflush(stdout);
+
+  chat_session_run(&cs);
+
+  //quitting
+  if (use_shm)
+    chat_shm_close(&cs);
+  else
+    chat_fifo_close(&cs);
+  free(cs.screen.data);
+}
+
+
+
+/**
+ * Pending reminders live in a min-heap ordered by due time. One timerfd,
+ * armed for the earliest entry, is polled together with stdin by the
+ * prompt, so no process is kept around per reminder.
+ */
+struct reminder_entry {
+  int id;
+  struct timespec due; // CLOCK_REALTIME
+  char *message;
+};
+
+static struct reminder_entry *reminders = NULL;
+static int reminder_count = 0, reminder_cap = 0;
+static int reminder_next_id = 1;
+static int reminder_timer = -1;
+static bool reminder_alerts = false; // only an interactive shell fires them
+// heap position of every id, -1 when not pending; ids are dense, so replay
+// finds a record's reminder in O(1)
+static int *reminder_slots = NULL;
+static int reminder_slot_cap = 0;
+
+static void reminder_slot_set(int id, int i) {
+  if (id >= reminder_slot_cap) {
+    int cap = reminder_slot_cap ? reminder_slot_cap : 64;
+    while (cap <= id)
+      cap *= 2;
+    reminder_slots = realloc(reminder_slots, sizeof(int) * cap);
+    for (int k = reminder_slot_cap; k < cap; k++)
+      reminder_slots[k] = -1;
+    reminder_slot_cap = cap;
+  }
+  reminder_slots[id] = i;
+}
+
+static bool reminder_before(const struct reminder_entry *a,
+                            const struct reminder_entry *b) {
+  if (a->due.tv_sec != b->due.tv_sec)
+    return a->due.tv_sec < b->due.tv_sec;
+  return a->due.tv_nsec < b->due.tv_nsec;
+}
+
+static void reminder_swap(int i, int j) {
+  struct reminder_entry tmp = reminders[i];
+  reminders[i] = reminders[j];
+  reminders[j] = tmp;
+  reminder_slots[reminders[i].id] = i;
+  reminder_slots[reminders[j].id] = j;
+}
+
+static void reminder_sift_up(int i) {
+  while (i > 0 && reminder_before(&reminders[i], &reminders[(i - 1) / 2])) {
+    reminder_swap(i, (i - 1) / 2);
+    i = (i - 1) / 2;
+  }
+}
+
+static void reminder_sift_down(int i) {
+  while (1) {
+    int smallest = i;
+    for (int child = 2 * i + 1; child <= 2 * i + 2; child++)
+      if (child < reminder_count &&
+          reminder_before(&reminders[child], &reminders[smallest]))
+        smallest = child;
+    if (smallest == i)
+      return;
+    reminder_swap(i, smallest);
+    i = smallest;
+  }
+}
+
+//arm the timer for the earliest reminder, or disarm it
+static void reminder_arm() {
+  if (!reminder_alerts) // batch shells only keep the journal
+    return;
+  if (reminder_timer < 0) {
+    reminder_timer =
+        timerfd_create(CLOCK_REALTIME, TFD_NONBLOCK | TFD_CLOEXEC);
+    if (reminder_timer < 0) {
+      perror("timerfd_create");
+      return;
+    }
+  }
+  struct itimerspec when = {0};
+  if (reminder_count > 0)
+    when.it_value = reminders[0].due;
+  timerfd_settime(reminder_timer, TFD_TIMER_ABSTIME, &when, NULL);
+}
+
+/**
+ * Reminders are persisted in an append-only journal of fixed size records:
+ * one ADD when a reminder is set and one DONE when it fires or is
+ * cancelled. It is mmap'd and replayed in one pass at startup and rewritten
+ * with only the live reminders once dead records pile up. Shells sharing
+ * the file flock it around every change and replay what the others
+ * appended, so each reminder fires in exactly one of them.
+ */
+#define REMINDER_RECORD_SIZE 256
+#define REMINDER_RECORD_ADD 0x41444452  // "RDDA"
+#define REMINDER_RECORD_DONE 0x454e4f44 // "DONE"
+#define REMINDER_COMPACT_MIN 64
+
+struct reminder_record {
+  uint32_t type;
+  int32_t id;
+  int64_t due_sec;
+  int64_t due_nsec;
+  char message[REMINDER_RECORD_SIZE - 24];
+};
+_Static_assert(sizeof(struct reminder_record) == REMINDER_RECORD_SIZE,
+               "journal records are fixed size");
+
+static int reminder_journal = -1;
+static char *reminder_journal_path = NULL;
+static ino_t reminder_journal_ino = 0;
+static off_t reminder_journal_offset = 0; // replayed up to here
+static long reminder_journal_records = 0; // records in the file
+
+static void reminder_journal_append(struct reminder_record *record) {
+  if (reminder_journal < 0)
+    return;
+  if (write(reminder_journal, record, sizeof(*record)) == sizeof(*record)) {
+    reminder_journal_records++;
+    reminder_journal_offset += sizeof(*record);
+  }
+}
+
+static void reminder_journal_done(int id) {
+  struct reminder_record record = {0};
+  record.type = REMINDER_RECORD_DONE;
+  record.id = id;
+  reminder_journal_append(&record);
+}
+
+static void reminder_fill_record(struct reminder_record *record,
+                                 const struct reminder_entry *r) {
+  memset(record, 0, sizeof(*record));
+  record->type = REMINDER_RECORD_ADD;
+  record->id = r->id;
+  record->due_sec = r->due.tv_sec;
+  record->due_nsec = r->due.tv_nsec;
+  snprintf(record->message, sizeof(record->message), "%s", r->message);
+}
+
+//take a reminder out of the heap, the journal is not touched
+static void reminder_drop_at(int i) {
+  free(reminders[i].message);
+  reminder_slots[reminders[i].id] = -1;
+  reminders[i] = reminders[--reminder_count];
+  if (i < reminder_count) {
+    reminder_slots[reminders[i].id] = i;
+    reminder_sift_down(i);
+    reminder_sift_up(i);
+  }
+}
+
+static void reminder_remove_at(int i) {
+  reminder_journal_done(reminders[i].id);
+  reminder_drop_at(i);
+}
+
+static int reminder_find(int id) {
+  return id > 0 && id < reminder_slot_cap ? reminder_slots[id] : -1;
+}
+
+/**
+ * Queue a reminder under an id already taken from reminder_next_id
+ */
+static void reminder_push(int id, struct timespec due, const char *message) {
+  if (reminder_count == reminder_cap) {
+    reminder_cap = reminder_cap ? reminder_cap * 2 : 16;
+    reminders = realloc(reminders, sizeof(struct reminder_entry) * reminder_cap);
+  }
+  struct reminder_entry *r = &reminders[reminder_count];
+  r->id = id;
+  r->due = due;
+  r->message = strdup(message);
+  reminder_slot_set(id, reminder_count);
+  reminder_sift_up(reminder_count++);
+}
+
+/**
+ * Apply the records other shells appended since the last call. Called
+ * with the journal locked; a torn record left by a crash is cut off so
+ * later records stay aligned.
+ */
+static void reminder_journal_replay() {
+  struct stat st;
+  if (fstat(reminder_journal, &st) < 0)
+    return;
+  off_t size = st.st_size - st.st_size % REMINDER_RECORD_SIZE;
+  if (size < st.st_size)
+    ftruncate(reminder_journal, size);
+  if (size < reminder_journal_offset) { // cannot shrink, start over
+    while (reminder_count > 0)
+      reminder_drop_at(reminder_count - 1);
+    reminder_journal_offset = 0;
+  }
+  reminder_journal_records = size / REMINDER_RECORD_SIZE;
+  if (size == reminder_journal_offset)
+    return;
+
+  struct reminder_record *records =
+      mmap(NULL, size, PROT_READ, MAP_PRIVATE, reminder_journal, 0);
+  if (records == MAP_FAILED)
+    return;
+  for (long i = reminder_journal_offset / REMINDER_RECORD_SIZE;
+       i < reminder_journal_records; i++) {
+    struct reminder_record *record = &records[i];
+    if (record->id <= 0)
+      continue;
+    if (record->id >= reminder_next_id)
+      reminder_next_id = record->id + 1;
+    int at = reminder_find(record->id);
+    if (record->type == REMINDER_RECORD_DONE && at >= 0) {
+      reminder_drop_at(at);
+    } else if (record->type == REMINDER_RECORD_ADD && at < 0) {
+      char message[sizeof(record->message) + 1];
+      memcpy(message, record->message, sizeof(record->message));
+      message[sizeof(record->message)] = 0;
+      struct timespec due = {record->due_sec, record->due_nsec};
+      reminder_push(record->id, due, message);
+    }
+  }
+  munmap(records, size);
+  reminder_journal_offset = size;
+}
+
+/**
+ * Lock the journal against the other shells sharing it and catch up with
+ * what they wrote. After another shell compacted it the path names a new
+ * file, which is reopened and replayed from the start.
+ * @return false when there is no journal
+ */
+static bool reminder_journal_lock() {
+  if (!reminder_journal_path)
+    return false;
+  while (1) {
+    if (reminder_journal < 0) {
+      reminder_journal = open(reminder_journal_path,
+                              O_RDWR | O_CREAT | O_APPEND | O_CLOEXEC, 0600);
+      if (reminder_journal < 0)
+        return false;
+    }
+    if (flock(reminder_journal, LOCK_EX) < 0) {
+      if (errno == EINTR)
+        continue;
+      return false;
+    }
+    struct stat held, named;
+    if (fstat(reminder_journal, &held) == 0 &&
+        stat(reminder_journal_path, &named) == 0 &&
+        held.st_dev == named.st_dev && held.st_ino == named.st_ino) {
+      if (held.st_ino != reminder_journal_ino) { // a different file
+        while (reminder_count > 0)
+          reminder_drop_at(reminder_count - 1);
+        reminder_journal_offset = 0;
+        reminder_journal_ino = held.st_ino;
+      }
+      break;
+    }
+    close(reminder_journal); // replaced or removed meanwhile
+    reminder_journal = -1;
+  }
+  reminder_journal_replay();
+  return true;
+}
+
+static void reminder_journal_unlock() {
+  if (reminder_journal >= 0)
+    flock(reminder_journal, LOCK_UN);
+}
+
+int reminder_add(struct timespec due, const char *message) {
+  reminder_journal_lock(); // ids are unique across shells
+  int id = reminder_next_id++;
+  struct reminder_entry entry = {id, due, (char *)message};
+  struct reminder_record record;
+  reminder_fill_record(&record, &entry);
+  reminder_journal_append(&record);
+  reminder_journal_unlock();
+  reminder_push(id, due, message);
+  reminder_arm();
+  return id;
+}
+
+/**
+ * Rewrite the journal with one ADD per pending reminder, with it locked
+ * and replayed so nothing another shell added is lost
+ */
+static void reminder_journal_compact() {
+  char tmp_path[PATH_MAX];
+  snprintf(tmp_path, sizeof(tmp_path), "%s.tmp", reminder_journal_path);
+  int fd = open(tmp_path, O_RDWR | O_CREAT | O_TRUNC | O_APPEND | O_CLOEXEC,
+                0600);
+  if (fd < 0)
+    return;
+  struct reminder_record *records =
+      malloc(sizeof(struct reminder_record) * (reminder_count + 1));
+  for (int i = 0; i < reminder_count; i++)
+    reminder_fill_record(&records[i], &reminders[i]);
+  size_t size = sizeof(struct reminder_record) * reminder_count;
+  bool ok = write(fd, records, size) == (ssize_t)size && fsync(fd) == 0;
+  free(records);
+  if (!ok || rename(tmp_path, reminder_journal_path) < 0) {
+    close(fd);
+    unlink(tmp_path);
+    return;
+  }
+  // keep the renamed file's fd, appends after the rename are not missed
+  struct stat st;
+  fstat(fd, &st);
+  close(reminder_journal); // drops the lock on the old file
+  reminder_journal = fd;
+  reminder_journal_ino = st.st_ino;
+  reminder_journal_offset = size;
+  reminder_journal_records = reminder_count;
+}
+
+static void reminder_journal_maybe_compact() {
+  if (reminder_journal_records > REMINDER_COMPACT_MIN &&
+      reminder_journal_records > 4L * reminder_count)
+    reminder_journal_compact();
+}
+
+/**
+ * Catch up with the journal and re-arm for the earliest reminder
+ */
+void reminders_sync() {
+  if (reminder_journal_lock()) {
+    reminder_journal_maybe_compact();
+    reminder_journal_unlock();
+  }
+  if (reminder_count > 0 || reminder_timer >= 0)
+    reminder_arm();
+}
+
+/**
+ * Load the journal and re-arm every pending reminder, called once at startup
+ * @param path   journal file, created if missing
+ * @param alerts arm the timer and fire reminders, false for batch shells
+ *               whose output is not the user's terminal
+ */
+void reminders_load(const char *path, bool alerts) {
+  reminder_journal_path = strdup(path);
+  reminder_alerts = alerts;
+  reminders_sync(); // overdue ones fire at the first prompt
+}
+
+/**
+ * The fd the prompt polls for due reminders, -1 if none was ever set
+ */
+int reminder_fd() { return reminder_timer; }
+
+/**
+ * Print every reminder that is due. The DONE record is written under the
+ * journal lock first, so a reminder several shells know fires only once.
+ * @return number of reminders printed
+ */
+int reminders_fire() {
+  uint64_t expirations;
+  if (reminder_timer >= 0)
+    read(reminder_timer, &expirations, sizeof(expirations));
+
+  bool locked = reminder_journal_lock();
+  struct timespec now;
+  clock_gettime(CLOCK_REALTIME, &now);
+  int fired = 0;
+  while (reminder_count > 0 &&
+         (reminders[0].due.tv_sec < now.tv_sec ||
+          (reminders[0].due.tv_sec == now.tv_sec &&
+           reminders[0].due.tv_nsec <= now.tv_nsec))) {
+    // \a activates bell \n \r moves to new line without interfering the users current prompt
+    printf("\n\r\a[REMINDER] %s\n", reminders[0].message);
+    reminder_remove_at(0);
+    fired++;
+  }
+  fflush(stdout);
+  if (locked) {
+    reminder_journal_maybe_compact();
+    reminder_journal_unlock();
+  }
+  reminder_arm();
+  return fired;
+}
+
+static int reminder_compare_due(const void *a, const void *b) {
+  const struct reminder_entry *x = a, *y = b;
+  return reminder_before(x, y) ? -1 : reminder_before(y, x) ? 1 : 0;
+}
+
+/**
+ * remind builtin
+ * remind <seconds> <message...>  queue a reminder
+ * remind -l                      list pending reminders
+ * remind -c <id>                 cancel a reminder
+ */
+void reminder(char **inputs) {
+  if (inputs[1] != NULL && strcmp(inputs[1], "-l") == 0) {
+    reminders_sync(); // shows what other shells set too
+    if (reminder_count == 0) {
+      printf("no pending reminders\n");
+      return;
+    }
+    struct reminder_entry *sorted =
+        malloc(sizeof(struct reminder_entry) * reminder_count);
+    memcpy(sorted, reminders, sizeof(struct reminder_entry) * reminder_count);
+    qsort(sorted, reminder_count, sizeof(struct reminder_entry),
+          reminder_compare_due);
+    struct timespec now;
+    clock_gettime(CLOCK_REALTIME, &now);
+    for (int i = 0; i < reminder_count; i++)
+      printf("[%d] in %lds: %s\n", sorted[i].id,
+             (long)(sorted[i].due.tv_sec - now.tv_sec), sorted[i].message);
+    free(sorted);
+    return;
+  }
+
+  if (inputs[1] != NULL && strcmp(inputs[1], "-c") == 0) {
+    if (inputs[2] == NULL) {
+      printf("remind -c <id>\n");
+      return;
+    }
+    int id = atoi(inputs[2]);
+    bool locked = reminder_journal_lock();
+    int i = reminder_find(id);
+    if (i >= 0) {
+      reminder_remove_at(i);
+      if (locked)
+        reminder_journal_maybe_compact();
+    }
+    if (locked)
+      reminder_journal_unlock();
+    reminder_arm();
+    if (i >= 0) {
+      printf("[Reminder %d cancelled]\n", id);
+      return;
+    }
+    printf("remind: no reminder with id %s\n", inputs[2]);
+    return;
+  }
+
+  if (inputs[1] == NULL || inputs[2] == NULL) {
+    printf("remind <seconds> <message...>\n");
+    printf("remind -l | -c <id>\n");
+    return;
+  }
+
+  int time = atoi(inputs[1]);
+  if (time <= 0) {
+    printf("seconds should be positive\n");
+    return;
+  }
+
+  //reconstructing the message
+  size_t len = 0;
+  for (int x = 2; inputs[x] != NULL; x++)
+    len += strlen(inputs[x]) + 1;
+  char *this_message = malloc(len + 1);
+  this_message[0] = 0;
+  for (int x = 2; inputs[x] != NULL; x++) {
+    strcat(this_message, inputs[x]);
+    if (inputs[x + 1] != NULL)
+      strcat(this_message, " ");
+  }
+
+  struct timespec due;
+  clock_gettime(CLOCK_REALTIME, &due);
+  due.tv_sec += time;
+  int id = reminder_add(due, this_message);
+  free(this_message);
+  printf("[Reminder %d set for %d seconds from now]\n", id, time);
+}
+
+
+
+
+//struct for process info
+struct processes {
+  int pid;
+  int parentid;
+  char name[256];
+  uid_t uid;
+  unsigned long long cpu_ticks; // utime + stime
+  unsigned long long starttime; // ticks after boot
+  long rss_pages;
+  struct timespec stat_ctime; // of /proc/<pid>/stat, new for a reused pid
+};
+
+#define PROC_PARALLEL_MIN 8192 // pid count that makes threads worth it
+#define PROC_MAX_WORKERS 16
+
+struct proc_scan_stats {
+  int entries; // numeric entries in /proc
+  int threads;
+  double seconds;
+};
+
+/**
+ * Parse the contents of /proc/<pid>/stat. The name may itself contain
+ * spaces and ')', so it runs from the first '(' to the last ')'.
+ * @return 0, or -1 if the line is malformed
+ */
+int proc_parse_stat(char *buf, size_t len, struct processes *proc) {
+  char *open_paren = memchr(buf, '(', len);
+  char *close_paren = memrchr(buf, ')', len);
+  if (!open_paren || !close_paren || close_paren < open_paren)
+    return -1;
+  size_t name_len = close_paren - open_paren - 1;
+  if (name_len >= sizeof(proc->name))
+    name_len = sizeof(proc->name) - 1;
+  memcpy(proc->name, open_paren + 1, name_len);
+  proc->name[name_len] = 0;
+
+  // ") S ppid ...", fields counted as in proc(5)
+  char *p = close_paren + 1;
+  char *end = buf + len;
+  while (p < end && *p == ' ')
+    p++;
+  if (p >= end)
+    return -1;
+  p++; // 3 state
+  unsigned long long fields[25] = {0};
+  int field = 4;
+  for (; field <= 24 && p < end; field++) {
+    char *endp;
+    fields[field] = strtoull(p, &endp, 10); // negative ones wrap, unused
+    if (endp == p)
+      break;
+    p = endp;
+  }
+  if (field <= 4)
+    return -1;
+  proc->parentid = fields[4];
+  proc->cpu_ticks = fields[14] + fields[15];
+  proc->starttime = fields[22];
+  proc->rss_pages = fields[24];
+  return 0;
+}
+
+/**
+ * Read one process relative to an open /proc, with a single read()
+ * @return 0, or -1 if it is gone or unreadable
+ */
+int proc_read_one(int proc_fd, int pid, struct processes *proc) {
+  char path[32];
+  snprintf(path, sizeof(path), "%d/stat", pid);
+  int fd = openat(proc_fd, path, O_RDONLY | O_CLOEXEC);
+  if (fd < 0)
+    return -1;
+  char buf[1024];
+  ssize_t len = read(fd, buf, sizeof(buf));
+  struct stat st; // the owner of the stat file is the owner of the process
+  if (fstat(fd, &st) == 0) {
+    proc->uid = st.st_uid;
+    proc->stat_ctime = st.st_ctim;
+  } else {
+    proc->uid = (uid_t)-1;
+    proc->stat_ctime = (struct timespec){0};
+  }
+  close(fd);
+  if (len <= 0)
+    return -1;
+  proc->pid = pid;
+  return proc_parse_stat(buf, len, proc);
+}
+
+struct proc_scan_job {
+  int proc_fd;
+  const int *pids;
+  struct processes *process;
+  bool *valid;
+  int from, to;
+};
+
+static void *proc_scan_worker(void *arg) {
+  struct proc_scan_job *job = arg;
+  for (int i = job->from; i < job->to; i++)
+    job->valid[i] = proc_read_one(job->proc_fd, job->pids[i],
+                                  &job->process[i]) == 0;
+  return NULL;
+}
+
+/**
+ * Read every process in /proc
+ * @param  count set to the number of processes
+ * @param  stats filled with scan statistics
+ * @return       malloc'd process table or NULL
+ */
+struct processes *proc_scan(int *count, struct proc_scan_stats *stats) {
+  struct timespec started, finished;
+  clock_gettime(CLOCK_MONOTONIC, &started);
+
+  DIR *curr = opendir("/proc");
+  if (!curr) {
+    perror("cant open proc");
+    return NULL;
+  }
+  int proc_fd = dirfd(curr);
+
+  //collect numeric entries first so they can be split between threads
+  int cap = 1024, n = 0;
+  int *pids = malloc(sizeof(int) * cap);
+  struct dirent *directory;
+  while ((directory = readdir(curr)) != NULL) {
+    if (!isdigit(directory->d_name[0]))
+      continue;
+    if (n == cap) {
+      cap *= 2;
+      pids = realloc(pids, sizeof(int) * cap);
+    }
+    pids[n++] = atoi(directory->d_name);
+  }
+
+  struct processes *process = malloc(sizeof(struct processes) * (n + 1));
+  bool *valid = malloc(sizeof(bool) * (n + 1));
+
+  long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+  int workers = 1;
+  if (n >= PROC_PARALLEL_MIN && cpus > 1)
+    workers = cpus > PROC_MAX_WORKERS ? PROC_MAX_WORKERS : cpus;
+
+  struct proc_scan_job jobs[PROC_MAX_WORKERS];
+  pthread_t threads[PROC_MAX_WORKERS];
+  int started_threads = 0;
+  for (int w = 0; w < workers; w++) {
+    jobs[w] = (struct proc_scan_job){proc_fd, pids, process, valid,
+                                     (int)((long)n * w / workers),
+                                     (int)((long)n * (w + 1) / workers)};
+    // the first share runs on this thread
+    if (w > 0 &&
+        pthread_create(&threads[started_threads], NULL, proc_scan_worker,
+                       &jobs[w]) == 0) {
+      started_threads++;
+      continue;
+    }
+    if (w > 0) // no thread, do it here
+      proc_scan_worker(&jobs[w]);
+  }
+  proc_scan_worker(&jobs[0]);
+  for (int t = 0; t < started_threads; t++)
+    pthread_join(threads[t], NULL);
+  closedir(curr);
+
+  //squeeze out processes that exited while scanning
+  int kept = 0;
+  for (int i = 0; i < n; i++)
+    if (valid[i])
+      process[kept++] = process[i];
+  free(valid);
+  free(pids);
+
+  clock_gettime(CLOCK_MONOTONIC, &finished);
+  stats->entries = n;
+  stats->threads = started_threads + 1;
+  stats->seconds = (finished.tv_sec - started.tv_sec) +
+                   (finished.tv_nsec - started.tv_nsec) / 1e9;
+  *count = kept;
+  return process;
+}
+
+/**
+ * Parent -> children index over the process table: order holds process
+ * indexes sorted by (parentid, pid), so the children of a pid are one
+ * contiguous run found by binary search.
+ */
+struct process_index {
+  struct processes *process;
+  int count;
+  int *order;
+};
+
+static struct processes *sort_base; // qsort has no context argument
+
+static int compare_by_parent(const void *a, const void *b) {
+  const struct processes *x = &sort_base[*(const int *)a];
+  const struct processes *y = &sort_base[*(const int *)b];
+  if (x->parentid != y->parentid)
+    return x->parentid < y->parentid ? -1 : 1;
+  return (x->pid > y->pid) - (x->pid < y->pid);
+}
+
+void process_index_build(struct process_index *index,
+                         struct processes *process, int count) {
+  index->process = process;
+  index->count = count;
+  index->order = malloc(sizeof(int) * (count > 0 ? count : 1));
+  for (int i = 0; i < count; i++)
+    index->order[i] = i;
+  sort_base = process;
+  qsort(index->order, count, sizeof(int), compare_by_parent);
+}
+
+/**
+ * Find the children of a pid
+ * @return position of the first child in order, *n set to how many
+ */
+int process_index_children(const struct process_index *index, int pid,
+                           int *n) {
+  int lo = 0, hi = index->count;
+  while (lo < hi) { // first entry with parentid >= pid
+    int mid = (lo + hi) / 2;
+    if (index->process[index->order[mid]].parentid < pid)
+      lo = mid + 1;
+    else
+      hi = mid;
+  }
+  int end = lo;
+  while (end < index->count &&
+         index->process[index->order[end]].parentid == pid)
+    end++;
+  *n = end - lo;
+  return lo;
+}
+
+//one visited node of a tree walk, in depth first order
+struct tree_node {
+  struct processes *proc;
+  int depth;
+  int parent; // position of the parent node, -1 for a root
+  bool keep;  // matches the filter or has a descendant that does
+  long total_rss_pages;
+  unsigned long long total_cpu_ticks;
+};
+
+/**
+ * Walk the tree under root_pid depth first with an explicit stack, then
+ * roll up subtree totals and filter matches in one reverse (post-order) pass
+ * @param  index        [description]
+ * @param  root_pid     print this pid and its subtree, or everything under
+ *                      pid 0 when it is 0
+ * @param  uid          only count and keep processes of this user, -1 for all
+ * @param  node_count   set to the number of nodes
+ * @return              malloc'd nodes, NULL if root_pid does not exist
+ */
+struct tree_node *tree_walk(const struct process_index *index, int root_pid,
+                            uid_t uid, int *node_count) {
+  struct tree_frame {
+    int slot;   // position in order
+    int depth;
+    int parent; // node position
+  };
+  struct tree_frame *stack =
+      malloc(sizeof(struct tree_frame) * (index->count + 1));
+  struct tree_node *nodes =
+      malloc(sizeof(struct tree_node) * (index->count + 1));
+  int top = 0, n_nodes = 0;
+
+  int n;
+  int first;
+  if (root_pid != 0) {
+    int found = -1;
+    for (int i = 0; i < index->count && found < 0; i++)
+      if (index->process[index->order[i]].pid == root_pid)
+        found = i;
+    if (found < 0) {
+      free(stack);
+      free(nodes);
+      return NULL;
+    }
+    stack[top++] = (struct tree_frame){found, 0, -1};
+  } else {
+    first = process_index_children(index, 0, &n);
+    for (int i = n - 1; i >= 0; i--) // reversed so the lowest pid pops first
+      stack[top++] = (struct tree_frame){first + i, 0, -1};
+  }
+
+  while (top > 0) {
+    struct tree_frame frame = stack[--top];
+    struct tree_node *node = &nodes[n_nodes];
+    node->proc = &index->process[index->order[frame.slot]];
+    node->depth = frame.depth;
+    node->parent = frame.parent;
+    node->keep = uid == (uid_t)-1 || node->proc->uid == uid;
+    node->total_rss_pages = node->keep ? node->proc->rss_pages : 0;
+    node->total_cpu_ticks = node->keep ? node->proc->cpu_ticks : 0;
+
+    first = process_index_children(index, node->proc->pid, &n);
+    for (int i = n - 1; i >= 0; i--)
+      stack[top++] = (struct tree_frame){first + i, frame.depth + 1, n_nodes};
+    n_nodes++;
+  }
+  free(stack);
+
+  // children always come after their parent, so a reverse pass is post-order
+  for (int i = n_nodes - 1; i >= 0; i--) {
+    int parent = nodes[i].parent;
+    if (parent < 0)
+      continue;
+    nodes[parent].total_rss_pages += nodes[i].total_rss_pages;
+    nodes[parent].total_cpu_ticks += nodes[i].total_cpu_ticks;
+    if (nodes[i].keep)
+      nodes[parent].keep = true;
+  }
+
+  *node_count = n_nodes;
+  return nodes;
+}
+
+static void format_kb(char *out, size_t size, double kb) {
+  if (kb >= 1024 * 1024)
+    snprintf(out, size, "%.1fG", kb / (1024 * 1024));
+  else if (kb >= 1024)
+    snprintf(out, size, "%.1fM", kb / 1024);
+  else
+    snprintf(out, size, "%.0fK", kb);
+}
+
+/**
+ * Format the line of one node
+ * @return length of the line, without a newline
+ */
+static int tree_format_line(const struct tree_node *nodes, int count, int i,
+                            bool resources, char *line, size_t size) {
+  const struct tree_node *node = &nodes[i];
+  size_t len = 0;
+#define TREE_APPEND(...)                                                       \
+  if (len < size)                                                              \
+  len += snprintf(line + len, size - len, __VA_ARGS__)
+
+  //indentation based on depth, cut at the line size so a deep chain stays
+  //linear instead of formatting depth pieces per line
+  len = (size_t)node->depth * 2;
+  if (len > size - 1)
+    len = size - 1;
+  memset(line, ' ', len);
+  line[len] = '\0';
+  if (node->depth > 0)
+    TREE_APPEND("|- ");
+  TREE_APPEND("%s [%d]", node->proc->name, node->proc->pid);
+
+  if (resources) {
+    long page_kb = sysconf(_SC_PAGESIZE) / 1024;
+    double tick = 1.0 / sysconf(_SC_CLK_TCK);
+    char rss[32], total_rss[32];
+    format_kb(rss, sizeof(rss), node->proc->rss_pages * page_kb);
+    format_kb(total_rss, sizeof(total_rss), node->total_rss_pages * page_kb);
+    TREE_APPEND(" rss %s cpu %.2fs", rss, node->proc->cpu_ticks * tick);
+    if (i + 1 < count && nodes[i + 1].parent == i) // has children
+      TREE_APPEND(" (subtree rss %s cpu %.2fs)", total_rss,
+                  node->total_cpu_ticks * tick);
+  }
+#undef TREE_APPEND
+  return len < size ? (int)len : (int)size - 1;
+}
+
+//prints nodes as an indented tree
+void tree_helper(const struct tree_node *nodes, int count, bool resources) {
+  char line[4096];
+  for (int i = 0; i < count; i++) {
+    if (!nodes[i].keep)
+      continue;
+    tree_format_line(nodes, count, i, resources, line, sizeof(line));
+    puts(line);
+  }
+}
+
+static void json_string(const char *str) {
+  putchar('"');
+  for (const unsigned char *c = (const unsigned char *)str; *c; c++) {
+    if (*c == '"' || *c == '\\')
+      printf("\\%c", *c);
+    else if (*c < 0x20)
+      printf("\\u%04x", *c);
+    else
+      putchar(*c);
+  }
+  putchar('"');
+}
+
+//prints nodes as a json array of nested objects
+void tree_print_json(const struct tree_node *nodes, int count) {
+  long page_kb = sysconf(_SC_PAGESIZE) / 1024;
+  long ticks_per_second = sysconf(_SC_CLK_TCK);
+  int depth = -1;          // depth of the last object still open
+  bool just_opened = true; // nothing yet in the innermost array
+
+  putchar('[');
+  for (int i = 0; i < count; i++) {
+    const struct tree_node *node = &nodes[i];
+    if (!node->keep)
+      continue;
+    // close objects until we are at this node's parent
+    for (; depth >= node->depth; depth--) {
+      fputs("]}", stdout);
+      just_opened = false;
+    }
+    if (!just_opened)
+      putchar(',');
+
+    printf("{\"pid\":%d,\"ppid\":%d,\"name\":", node->proc->pid,
+           node->proc->parentid);
+    json_string(node->proc->name);
+    printf(",\"uid\":%d,\"rss_kb\":%ld,\"cpu_ms\":%llu,"
+           "\"total_rss_kb\":%ld,\"total_cpu_ms\":%llu,\"children\":[",
+           (int)node->proc->uid, node->proc->rss_pages * page_kb,
+           node->proc->cpu_ticks * 1000 / ticks_per_second,
+           node->total_rss_pages * page_kb,
+           node->total_cpu_ticks * 1000 / ticks_per_second);
+    depth = node->depth;
+    just_opened = true;
+  }
+  for (; depth >= 0; depth--)
+    fputs("]}", stdout);
+  puts("]");
+}
+
+#define PSTREE_FULL_REFRESH 10 // ticks between full rescans in watch mode
+
+static int compare_process_pid(const void *a, const void *b) {
+  const struct processes *x = a, *y = b;
+  return (x->pid > y->pid) - (x->pid < y->pid);
+}
+
+static int compare_int(const void *a, const void *b) {
+  int x = *(const int *)a, y = *(const int *)b;
+  return (x > y) - (x < y);
+}
+
+/**
+ * Rescan /proc against the previous snapshot. Only new pids and processes
+ * whose parent vanished (they were reparented) are read again, the rest
+ * keep their previous entry. A kept pid is stat'ed first: procfs gives a
+ * reused pid fresh inodes, so a changed ctime of its stat file means it is
+ * read again, and a changed starttime confirms a different process. The
+ * children of such a pid were reparented when the old one died, so they
+ * are read again too.
+ * @param  prev       previous table sorted by pid, or NULL
+ * @param  prev_count [description]
+ * @param  full       read every process
+ * @param  count      set to the size of the new table
+ * @param  reads      set to the number of stat files read
+ * @return            new table sorted by pid
+ */
+struct processes *proc_rescan(struct processes *prev, int prev_count,
+                              bool full, int *count, int *reads) {
+  if (!prev || full) {
+    struct proc_scan_stats stats;
+    struct processes *process = proc_scan(count, &stats);
+    if (process)
+      qsort(process, *count, sizeof(struct processes), compare_process_pid);
+    *reads = process ? stats.entries : 0;
+    return process;
+  }
+
+  DIR *curr = opendir("/proc");
+  if (!curr)
+    return NULL;
+  int proc_fd = dirfd(curr);
+  int cap = prev_count + 64, n = 0;
+  int *pids = malloc(sizeof(int) * cap);
+  struct dirent *directory;
+  while ((directory = readdir(curr)) != NULL) {
+    if (!isdigit(directory->d_name[0]))
+      continue;
+    if (n == cap) {
+      cap *= 2;
+      pids = realloc(pids, sizeof(int) * cap);
+    }
+    pids[n++] = atoi(directory->d_name);
+  }
+  qsort(pids, n, sizeof(int), compare_int);
+
+  struct processes *process = malloc(sizeof(struct processes) * (n + 1));
+  int *reused = malloc(sizeof(int) * (n + 1)); // ascending, like pids
+  int kept = 0, reused_count = 0;
+  *reads = 0;
+  for (int i = 0; i < n; i++) {
+    struct processes key = {.pid = pids[i]};
+    struct processes *old = bsearch(&key, prev, prev_count,
+                                    sizeof(struct processes),
+                                    compare_process_pid);
+    if (old && (old->parentid == 0 ||
+                bsearch(&old->parentid, pids, n, sizeof(int), compare_int))) {
+      char path[32];
+      struct stat st;
+      snprintf(path, sizeof(path), "%d/stat", pids[i]);
+      if (fstatat(proc_fd, path, &st, 0) < 0)
+        continue; // exited since readdir
+      if (st.st_ctim.tv_sec == old->stat_ctime.tv_sec &&
+          st.st_ctim.tv_nsec == old->stat_ctime.tv_nsec) {
+        process[kept++] = *old;
+        continue;
+      }
+    }
+    (*reads)++;
+    if (proc_read_one(proc_fd, pids[i], &process[kept]) == 0) {
+      if (old && process[kept].starttime != old->starttime)
+        reused[reused_count++] = pids[i];
+      kept++;
+    }
+  }
+
+  // their parent pid exists again, so the check above kept them
+  if (reused_count > 0) {
+    int k = 0;
+    for (int i = 0; i < kept; i++) {
+      if (bsearch(&process[i].parentid, reused, reused_count, sizeof(int),
+                  compare_int)) {
+        (*reads)++;
+        if (proc_read_one(proc_fd, process[i].pid, &process[i]) < 0)
+          continue; // exited meanwhile
+      }
+      process[k++] = process[i];
+    }
+    kept = k;
+  }
+  closedir(curr);
+  free(reused);
+  free(pids);
+  *count = kept;
+  return process;
+}
+
+/**
+ * Repeatedly print the tree, rewriting only the screen lines that changed
+ * @param interval seconds between refreshes
+ */
+void pstree_watch(int root_pid, uid_t uid, bool resources, double interval) {
+  bool tty = isatty(STDIN_FILENO);
+  struct termios backup_termios, new_termios;
+  if (tty) { // single keys, so q works without enter
+    tcgetattr(STDIN_FILENO, &backup_termios);
+    new_termios = backup_termios;
+    new_termios.c_lflag &= ~(ICANON | ECHO);
+    tcsetattr(STDIN_FILENO, TCSANOW, &new_termios);
+  }
+
+  struct out_buffer screen = {STDOUT_FILENO, malloc(CUT_BLOCK_SIZE), 0,
+                              CUT_BLOCK_SIZE};
+  const char *start = "\033[?25l\033[H\033[2J"; // hide cursor, clear
+  out_append(&screen, start, strlen(start));
+
+  struct processes *snapshot = NULL;
+  int snapshot_count = 0;
+  char **shown = NULL; // lines currently on screen, shown[0] is the header
+  int shown_count = 0;
+  char line[4096];
+
+  for (unsigned long tick = 0;; tick++) {
+    int count, reads;
+    bool full = resources || tick % PSTREE_FULL_REFRESH == 0;
+    struct processes *process =
+        proc_rescan(snapshot, snapshot_count, full, &count, &reads);
+    if (!process)
+      break;
+    free(snapshot);
+    snapshot = process;
+    snapshot_count = count;
+
+    struct process_index index;
+    process_index_build(&index, snapshot, snapshot_count);
+    int node_count;
+    struct tree_node *nodes = tree_walk(&index, root_pid, uid, &node_count);
+
+    struct winsize ws;
+    int rows = ioctl(STDOUT_FILENO, TIOCGWINSZ, &ws) == 0 && ws.ws_row > 1
+                   ? ws.ws_row
+                   : 24;
+
+    // build this frame, at most one screen high
+    char **frame = malloc(sizeof(char *) * rows);
+    int frame_count = 0;
+    snprintf(line, sizeof(line),
+             "Every %.1fs: pstree, %d processes, %d stat reads (q to quit)",
+             interval, snapshot_count, reads);
+    frame[frame_count++] = strdup(line);
+    for (int i = 0; nodes && i < node_count && frame_count < rows; i++) {
+      if (!nodes[i].keep)
+        continue;
+      tree_format_line(nodes, node_count, i, resources, line, sizeof(line));
+      frame[frame_count++] = strdup(line);
+    }
+    if (!nodes && frame_count < rows) {
+      snprintf(line, sizeof(line), "no process with pid %d", root_pid);
+      frame[frame_count++] = strdup(line);
+    }
+
+    // rewrite changed rows, then clear what the old frame had below
+    for (int i = 0; i < frame_count; i++) {
+      if (i < shown_count && strcmp(frame[i], shown[i]) == 0)
+        continue;
+      int len = snprintf(line, sizeof(line), "\033[%d;1H", i + 1);
+      out_append(&screen, line, len);
+      out_append(&screen, frame[i], strlen(frame[i]));
+      out_append(&screen, "\033[K", 3);
+    }
+    if (frame_count < shown_count) {
+      int len = snprintf(line, sizeof(line), "\033[%d;1H\033[J", frame_count + 1);
+      out_append(&screen, line, len);
+    }
+    out_flush(&screen);
+
+    for (int i = 0; i < shown_count; i++)
+      free(shown[i]);
+    free(shown);
+    shown = frame;
+    shown_count = frame_count;
+    free(nodes);
+    free(index.order);
+
+    struct pollfd in = {STDIN_FILENO, POLLIN, 0};
+    int ready = poll(&in, 1, (int)(interval * 1000));
+    if (builtin_interrupted)
+      break;
+    if (ready > 0) {
+      char key;
+      if (read(STDIN_FILENO, &key, 1) <= 0 || key == 'q' || key == 4)
+        break;
+    }
+  }
+
+  for (int i = 0; i < shown_count; i++)
+    free(shown[i]);
+  free(shown);
+  free(snapshot);
+  int len = snprintf(line, sizeof(line), "\033[%d;1H\033[?25h", shown_count + 1);
+  out_append(&screen, line, len);
+  out_flush(&screen);
+  free(screen.data);
+  if (tty)
+    tcsetattr(STDIN_FILENO, TCSANOW, &backup_termios);
+}
+
+/**
+ * pstree builtin
+ * pstree [pid] [-u user] [-r] [--json | --watch [seconds]] [--stats]
+ * pid     only the subtree of pid
+ * -u      only processes of user, with the ancestors that lead to them
+ * -r      rss and cpu time per process and rolled up per subtree
+ * --json  nested json with all of the above
+ * --watch [seconds]  redraw every few seconds (default 2), q quits
+ */
+void pstree(char **inputs) {
+  bool show_stats = false, resources = false, json = false;
+  double watch = 0; // refresh interval, 0 when not watching
+  int root_pid = 0;
+  uid_t uid = (uid_t)-1;
+  for (int x = 1; inputs[x] != NULL; x++) {
+    if (strcmp(inputs[x], "--stats") == 0)
+      show_stats = true;
+    else if (strcmp(inputs[x], "--json") == 0)
+      json = true;
+    else if (strcmp(inputs[x], "-r") == 0)
+      resources = true;
+    else if (strcmp(inputs[x], "--watch") == 0) {
+      watch = 2;
+      if (inputs[x + 1] != NULL && (isdigit(inputs[x + 1][0]) ||
+                                    inputs[x + 1][0] == '.'))
+        watch = atof(inputs[++x]);
+      if (watch < 0.1)
+        watch = 0.1;
+    } else if (strcmp(inputs[x], "-u") == 0) {
+      if (inputs[x + 1] == NULL) {
+        fprintf(stderr, "pstree: -u needs a user\n");
+        return;
+      }
+      struct passwd *pw = getpwnam(inputs[++x]);
+      if (pw)
+        uid = pw->pw_uid;
+      else if (isdigit(inputs[x][0]))
+        uid = atoi(inputs[x]);
+      else {
+        fprintf(stderr, "pstree: unknown user %s\n", inputs[x]);
+        return;
+      }
+    } else if (isdigit(inputs[x][0]))
+      root_pid = atoi(inputs[x]);
+    else {
+      fprintf(stderr, "pstree: unknown option %s\n", inputs[x]);
+      return;
+    }
+  }
+
+  if (watch > 0) {
+    pstree_watch(root_pid, uid, resources, watch);
+    return;
+  }
+
+  int count;
+  struct proc_scan_stats stats;
+  struct processes *process = proc_scan(&count, &stats);
+  if (!process)
+    return;
+
+  struct process_index index;
+  process_index_build(&index, process, count);
+
+  int node_count;
+  struct tree_node *nodes = tree_walk(&index, root_pid, uid, &node_count);
+  if (!nodes) {
+    fprintf(stderr, "pstree: no process with pid %d\n", root_pid);
+  } else if (json) {
+    tree_print_json(nodes, node_count);
+  } else {
+    //print from root
+    printf("System Process Tree:\n");
+    tree_helper(nodes, node_count, resources);
+  }
+
+  if (show_stats)
+    fprintf(json ? stderr : stdout,
+            "scanned %d /proc entries (%d processes) in %.3f ms on %d "
+            "thread%s\n",
+            stats.entries, count, stats.seconds * 1000, stats.threads,
+            stats.threads == 1 ? "" : "s");
+
+  free(nodes);
+  free(index.order);
+  free(process);
+}
+
+
+
+
+
+static int last_status = 0; // exit status of the last foreground pipeline
+static bool time_pipeline = false; // the next job reports what it cost
+
+//job control: every pipeline is a job in its own process group
+enum job_states { JOB_RUNNING, JOB_STOPPED, JOB_DONE };
+
+struct job_process {
+  pid_t pid;
+  int state; // job_states
+  int stage; // position in the pipeline
+  struct rusage usage;    // from wait4 once it is done
+  struct timespec ended;
+};
+
+struct job {
+  int id;
+  pid_t pgid;
+  struct job_process *procs;
+  int proc_count;
+  pid_t last_pid;
+  int status;      // exit status of the last stage
+  bool background;
+  int reported;    // state last printed, so each change is told once
+  bool has_tmodes; // terminal modes saved when it stopped
+  struct termios tmodes;
+  bool timed;      // started with the time prefix
+  struct timespec started;
+  char *text;
+};
+
+static struct job **jobs;
+static int job_count = 0, job_cap = 0;
+static bool interactive = true;  // false for -c, scripts and piped input
+static bool job_control = false; // interactive, the shell owns the terminal
+static pid_t shell_pgid;
+static struct termios shell_tmodes;
+static int sigchld_pipe[2] = {-1, -1};
+
+static void sigchld_handler(int sig) {
+  int saved = errno;
+  char byte = 0;
+  write(sigchld_pipe[1], &byte, 1); // nonblocking, a full pipe already wakes
+  errno = saved;
+}
+
+/**
+ * Install the SIGCHLD handler and, on a terminal, take it over
+ */
+void jobs_init() {
+  if (pipe2(sigchld_pipe, O_CLOEXEC | O_NONBLOCK) == 0) {
+    struct sigaction sa = {0};
+    sa.sa_handler = sigchld_handler;
+    sa.sa_flags = SA_RESTART;
+    sigemptyset(&sa.sa_mask);
+    sigaction(SIGCHLD, &sa, NULL);
+  }
+
+  job_control = interactive && isatty(STDIN_FILENO);
+  if (!job_control)
+    return;
+  // started in the background, wait to be brought to the foreground
+  while (tcgetpgrp(STDIN_FILENO) != (shell_pgid = getpgrp()))
+    kill(-shell_pgid, SIGTTIN);
+
+  signal(SIGINT, SIG_IGN);
+  signal(SIGQUIT, SIG_IGN);
+  signal(SIGTSTP, SIG_IGN);
+  signal(SIGTTIN, SIG_IGN);
+  signal(SIGTTOU, SIG_IGN);
+
+  setpgid(0, 0); // fails harmlessly when we already lead a session
+  shell_pgid = getpgrp();
+  tcsetpgrp(STDIN_FILENO, shell_pgid);
+  tcgetattr(STDIN_FILENO, &shell_tmodes);
+}
+
+int jobs_sigchld_fd() { return sigchld_pipe[0]; }
+
+/**
+ * Move a forked child into its job's process group with default signals
+ * @param pgid       group to join, 0 to start a new one
+ * @param foreground give the group the terminal
+ */
+void job_child_setup(pid_t pgid, bool foreground) {
+  if (!job_control)
+    return;
+  setpgid(0, pgid);
+  if (foreground)
+    tcsetpgrp(STDIN_FILENO, getpgrp());
+  signal(SIGINT, SIG_DFL);
+  signal(SIGQUIT, SIG_DFL);
+  signal(SIGTSTP, SIG_DFL);
+  signal(SIGTTIN, SIG_DFL);
+  signal(SIGTTOU, SIG_DFL);
+  signal(SIGCHLD, SIG_DFL);
+}
+
+/**
+ * New job for a pipeline, its text is rebuilt from the arguments
+ */
+struct job *job_create(struct command_t *command, int n) {
+  struct job *job = calloc(1, sizeof(struct job));
+  job->procs = malloc(sizeof(struct job_process) * n);
+  job->last_pid = -1;
+  job->background = command->background;
+  job->reported = JOB_RUNNING;
+
+  size_t len = 3;
+  for (struct command_t *c = command; c; c = c->next)
+    for (int i = 0; c->args[i]; i++)
+      len += strlen(c->args[i]) + 3;
+  job->text = malloc(len);
+  job->text[0] = '\0';
+  for (struct command_t *c = command; c; c = c->next) {
+    for (int i = 0; c->args[i]; i++) {
+      if (i > 0)
+        strcat(job->text, " ");
+      strcat(job->text, c->args[i]);
+    }
+    if (c->next)
+      strcat(job->text, " | ");
+  }
+  if (job->background)
+    strcat(job->text, " &");
+
+  // ids keep growing while any job is alive, like other shells
+  job->id = 1;
+  for (int i = 0; i < job_count; i++)
+    if (jobs[i]->id >= job->id)
+      job->id = jobs[i]->id + 1;
+  if (job_count == job_cap) {
+    job_cap = job_cap ? job_cap * 2 : 8;
+    jobs = realloc(jobs, sizeof(struct job *) * job_cap);
+  }
+  jobs[job_count++] = job;
+  return job;
+}
+
+/**
+ * Add a started stage, the first one names the process group
+ */
+void job_add_process(struct job *job, pid_t pid, int stage, bool last) {
+  if (job->pgid == 0)
+    job->pgid = pid;
+  if (job_control)
+    setpgid(pid, job->pgid); // the child does it too, whoever runs first
+  job->procs[job->proc_count].pid = pid;
+  job->procs[job->proc_count].stage = stage;
+  job->procs[job->proc_count++].state = JOB_RUNNING;
+  if (last)
+    job->last_pid = pid;
+}
+
+void job_remove(struct job *job) {
+  for (int i = 0; i < job_count; i++) {
+    if (jobs[i] == job) {
+      memmove(&jobs[i], &jobs[i + 1], sizeof(struct job *) * (job_count - i - 1));
+      job_count--;
+      break;
+    }
+  }
+  free(job->procs);
+  free(job->text);
+  free(job);
+}
+
+int job_state(const struct job *job) {
+  bool stopped = false;
+  for (int i = 0; i < job->proc_count; i++) {
+    if (job->procs[i].state == JOB_RUNNING)
+      return JOB_RUNNING;
+    if (job->procs[i].state == JOB_STOPPED)
+      stopped = true;
+  }
+  return stopped ? JOB_STOPPED : JOB_DONE;
+}
+
+/**
+ * Record a status change reported by wait4
+ */
+void job_update(pid_t pid, int wstatus, const struct rusage *usage) {
+  for (int i = 0; i < job_count; i++) {
+    struct job *job = jobs[i];
+    for (int j = 0; j < job->proc_count; j++) {
+      if (job->procs[j].pid != pid)
+        continue;
+      if (WIFSTOPPED(wstatus)) {
+        job->procs[j].state = JOB_STOPPED;
+        return;
+      }
+      if (WIFCONTINUED(wstatus)) {
+        job->procs[j].state = JOB_RUNNING;
+        return;
+      }
+      job->procs[j].state = JOB_DONE;
+      job->procs[j].usage = *usage;
+      clock_gettime(CLOCK_MONOTONIC, &job->procs[j].ended);
+      if (pid == job->last_pid) {
+        if (WIFEXITED(wstatus))
+          job->status = WEXITSTATUS(wstatus);
+        else if (WIFSIGNALED(wstatus))
+          job->status = 128 + WTERMSIG(wstatus);
+      }
+      return;
+    }
+  }
+}
+
+/**
+ * Collect every child that changed state, without blocking
+ */
+void jobs_reap() {
+  char drain[64];
+  while (read(sigchld_pipe[0], drain, sizeof(drain)) > 0)
+    ;
+  int wstatus;
+  pid_t pid;
+  struct rusage usage;
+  while ((pid = wait4(-1, &wstatus, WNOHANG | WUNTRACED | WCONTINUED,
+                      &usage)) > 0)
+    job_update(pid, wstatus, &usage);
+}
+
+static void job_print(const struct job *job, int state) {
+  char how[32];
+  if (state == JOB_RUNNING)
+    snprintf(how, sizeof(how), "Running");
+  else if (state == JOB_STOPPED)
+    snprintf(how, sizeof(how), "Stopped");
+  else if (job->status == 0)
+    snprintf(how, sizeof(how), "Done");
+  else
+    snprintf(how, sizeof(how), "Exit %d", job->status);
+  printf("[%d]%c  %-22s%s\n", job->id,
+         job_count > 0 && jobs[job_count - 1] == job ? '+' : ' ', how,
+         job->text);
+}
+
+/**
+ * Tell about background jobs that stopped or finished, dropping finished ones
+ * @return number of lines printed
+ */
+int jobs_notify() {
+  int printed = 0;
+  for (int i = 0; i < job_count; i++) {
+    struct job *job = jobs[i];
+    int state = job_state(job);
+    if (!job->background || state == job->reported)
+      continue;
+    if (!interactive) { // scripts are not told, finished jobs are dropped
+      if (state == JOB_DONE)
+        job_remove(job), i--;
+      continue;
+    }
+    if (printed++ == 0)
+      printf("\n\r");
+    job_print(job, state);
+    job->reported = state;
+    if (state == JOB_DONE)
+      job_remove(job), i--;
+  }
+  fflush(stdout);
+  return printed;
+}
+
+static double timespec_diff(const struct timespec *from,
+                            const struct timespec *to) {
+  return (to->tv_sec - from->tv_sec) + (to->tv_nsec - from->tv_nsec) / 1e9;
+}
+
+static double timeval_seconds(const struct timeval *tv) {
+  return tv->tv_sec + tv->tv_usec / 1e6;
+}
+
+static void time_row(const char *label, double wall, const struct rusage *ru,
+                     const char *text) {
+  char rss[32];
+  format_kb(rss, sizeof(rss), ru->ru_maxrss); // in KiB on linux
+  fprintf(stderr, "%-6s %9.3fs %9.3fs %9.3fs %8s %7ld %7ld %8ld %6ld%s%s\n",
+          label, wall, timeval_seconds(&ru->ru_utime),
+          timeval_seconds(&ru->ru_stime), rss, ru->ru_nvcsw, ru->ru_nivcsw,
+          ru->ru_minflt, ru->ru_majflt, text[0] ? "  " : "", text);
+}
+
+static void time_header() {
+  fflush(stdout); // the command's own output comes first
+  fprintf(stderr, "%-6s %10s %10s %10s %8s %7s %7s %8s %6s\n", "stage", "real",
+          "user", "sys", "maxrss", "vcsw", "ivcsw", "minflt", "majflt");
+}
+
+/**
+ * Print what a timed job cost, per stage and in total
+ * @param job     finished job
+ * @param command its pipeline, for the stage names
+ */
+void time_report_job(const struct job *job, struct command_t *command) {
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  struct rusage total = {0};
+  time_header();
+  for (int i = 0; i < job->proc_count; i++) {
+    const struct job_process *proc = &job->procs[i];
+    const struct rusage *ru = &proc->usage;
+    if (command->next) { // a row per stage only makes sense for pipelines
+      struct command_t *c = command;
+      for (int j = 0; j < proc->stage; j++)
+        c = c->next;
+      char label[16];
+      snprintf(label, sizeof(label), "%d", proc->stage + 1);
+      time_row(label, timespec_diff(&job->started, &proc->ended), ru, c->name);
+    }
+    timeradd(&total.ru_utime, &ru->ru_utime, &total.ru_utime);
+    timeradd(&total.ru_stime, &ru->ru_stime, &total.ru_stime);
+    if (ru->ru_maxrss > total.ru_maxrss)
+      total.ru_maxrss = ru->ru_maxrss; // stages run side by side, not summed
+    total.ru_nvcsw += ru->ru_nvcsw;
+    total.ru_nivcsw += ru->ru_nivcsw;
+    total.ru_minflt += ru->ru_minflt;
+    total.ru_majflt += ru->ru_majflt;
+  }
+  time_row("total", timespec_diff(&job->started, &now), &total, "");
+}
+
+/**
+ * Give a job the terminal and wait until it finishes or stops
+ * @param  job     [description]
+ * @param  resume  send SIGCONT first, for fg
+ * @param  command pipeline of the job for the time report, NULL after fg
+ * @return         exit status, 128 + SIGTSTP when it stopped
+ */
+int job_foreground(struct job *job, bool resume, struct command_t *command) {
+  editor_cooked_mode();
+  if (job_control) {
+    tcsetpgrp(STDIN_FILENO, job->pgid);
+    if (resume && job->has_tmodes)
+      tcsetattr(STDIN_FILENO, TCSADRAIN, &job->tmodes);
+  }
+  if (resume) {
+    for (int i = 0; i < job->proc_count; i++)
+      if (job->procs[i].state == JOB_STOPPED)
+        job->procs[i].state = JOB_RUNNING;
+    kill(-job->pgid, SIGCONT);
+  }
+  job->background = false;
+
+  // waiting on any child also reaps background jobs that finish meanwhile,
+  // the reminder timer is watched too so reminders fire during the job
+  while (job_state(job) == JOB_RUNNING) {
+    if (sigchld_pipe[0] < 0) { // no self-pipe, block in wait4 instead
+      int wstatus;
+      struct rusage usage;
+      pid_t pid = wait4(-1, &wstatus, WUNTRACED, &usage);
+      if (pid < 0) {
+        if (errno == EINTR)
+          continue;
+        break;
+      }
+      job_update(pid, wstatus, &usage);
+      continue;
+    }
+    jobs_reap(); // a SIGCHLD after this still leaves a byte in the pipe
+    if (job_state(job) != JOB_RUNNING)
+      break;
+    struct pollfd fds[2] = {{sigchld_pipe[0], POLLIN, 0},
+                            {interactive ? reminder_fd() : -1, POLLIN, 0}};
+    if (poll(fds, 2, -1) < 0 && errno != EINTR)
+      break;
+    if (interactive && (fds[1].revents & POLLIN))
+      reminders_fire();
+  }
+
+  if (job_control) {
+    tcsetpgrp(STDIN_FILENO, shell_pgid);
+    job->has_tmodes = tcgetattr(STDIN_FILENO, &job->tmodes) == 0;
+    tcsetattr(STDIN_FILENO, TCSADRAIN, &shell_tmodes);
+    editor_raw = false;
+  }
+
+  if (job_state(job) == JOB_STOPPED) {
+    job->background = true;
+    job->reported = JOB_STOPPED;
+    printf("\n");
+    job_print(job, JOB_STOPPED);
+    return 128 + SIGTSTP;
+  }
+  if (job->timed && command)
+    time_report_job(job, command);
+  int status = job->status;
+  job_remove(job);
+  return status;
+}
+
+/**
+ * Find a job from %n, n or nothing (the most recent one)
+ */
+struct job *job_find(const char *spec, const char *builtin) {
+  if (spec == NULL || strcmp(spec, "%") == 0 || strcmp(spec, "%+") == 0) {
+    if (job_count == 0) {
+      printf("-%s: %s: current: no such job\n", sysname, builtin);
+      return NULL;
+    }
+    return jobs[job_count - 1];
+  }
+  int id = atoi(spec[0] == '%' ? spec + 1 : spec);
+  for (int i = 0; i < job_count; i++)
+    if (jobs[i]->id == id)
+      return jobs[i];
+  printf("-%s: %s: %s: no such job\n", sysname, builtin, spec);
+  return NULL;
+}
+
+/**
+ * jobs, fg, bg and wait, run by the shell itself
+ * @return exit status
+ */
+int job_builtin(char **inputs) {
+  jobs_reap();
+  const char *name = inputs[0];
+
+  if (strcmp(name, "jobs") == 0) {
+    for (int i = 0; i < job_count; i++) {
+      struct job *job = jobs[i];
+      int state = job_state(job);
+      job_print(job, state);
+      job->reported = state;
+      if (state == JOB_DONE)
+        job_remove(job), i--;
+    }
+    return SUCCESS;
+  }
+
+  if (strcmp(name, "fg") == 0) {
+    struct job *job = job_find(inputs[1], name);
+    if (!job)
+      return EXIT_FAILURE;
+    printf("%s\n", job->text);
+    return job_foreground(job, true, NULL);
+  }
+
+  if (strcmp(name, "bg") == 0) {
+    struct job *job = job_find(inputs[1], name);
+    if (!job)
+      return EXIT_FAILURE;
+    for (int i = 0; i < job->proc_count; i++)
+      if (job->procs[i].state == JOB_STOPPED)
+        job->procs[i].state = JOB_RUNNING;
+    job->background = true;
+    job->reported = JOB_RUNNING;
+    kill(-job->pgid, SIGCONT);
+    printf("[%d] %s\n", job->id, job->text);
+    return SUCCESS;
+  }
+
+  // wait: for the given jobs or pids, or every running job
+  int status = SUCCESS;
+  struct job *target = NULL;
+  for (int x = 1; inputs[x] != NULL || x == 1; x++) {
+    if (inputs[x] != NULL) {
+      target = NULL;
+      if (inputs[x][0] == '%') {
+        target = job_find(inputs[x], name);
+      } else {
+        pid_t pid = atoi(inputs[x]);
+        for (int i = 0; i < job_count && !target; i++)
+          for (int j = 0; j < jobs[i]->proc_count; j++)
+            if (jobs[i]->procs[j].pid == pid)
+              target = jobs[i];
+        if (!target)
+          printf("-%s: wait: pid %s is not a child of this shell\n", sysname,
+                 inputs[x]);
+      }
+      if (!target) {
+        status = 127;
+        continue;
+      }
+    }
+    while (1) {
+      bool running = false;
+      for (int i = 0; i < job_count; i++)
+        if ((!target || jobs[i] == target) &&
+            job_state(jobs[i]) == JOB_RUNNING)
+          running = true;
+      if (!running)
+        break;
+      int wstatus;
+      struct rusage usage;
+      pid_t pid = wait4(-1, &wstatus, WUNTRACED, &usage);
+      if (pid < 0) {
+        if (errno == EINTR)
+          continue;
+        break;
+      }
+      job_update(pid, wstatus, &usage);
+    }
+    if (target && job_state(target) == JOB_DONE) {
+      status = target->status;
+      job_remove(target);
+    }
+    if (inputs[x] == NULL)
+      break;
+  }
+  return status;
+}
+
+/**
+ * Apply the redirects of a command to the current process
+ * @param  command [description]
+ * @return         0, or -1 when a file could not be opened
+ */
+int open_redirects(struct command_t *command) {
+  if (command->redirects[0]) {
+    //for input redirection
+    int inputfd = open(command->redirects[0], O_RDONLY);
+    if (inputfd < 0) {
+      perror("Input file cannot open");
+      return -1;
+    }
+    dup2(inputfd, STDIN_FILENO);
+    close(inputfd);
+  }
+  if (command->redirects[1]) {
+    // for output direction
+    int outputfd =
+        open(command->redirects[1], O_WRONLY | O_CREAT | O_TRUNC, 0666);
+    if (outputfd < 0) {
+      perror("output file cannot opened");
+      return -1;
+    }
+    dup2(outputfd, STDOUT_FILENO);
+    close(outputfd);
+  }
+  if (command->redirects[2]) {
+    //for appending
+    int appendingfd =
+        open(command->redirects[2], O_WRONLY | O_CREAT | O_APPEND, 0666);
+    if (appendingfd < 0) {
+      perror("append file cant open");
+      return -1;
+    }
+    dup2(appendingfd, STDOUT_FILENO);
+    close(appendingfd);
+  }
+  return 0;
+}
+
+/**
+ * Apply the redirects of a command in a child, exits on failure
+ * @param command [description]
+ */
+void apply_redirects(struct command_t *command) {
+  if (open_redirects(command) < 0)
+    exit(EXIT_FAILURE);
+}
+
+static bool exit_requested = false; // set by the exit builtin
+
+/**
+ * exit [status], the status defaults to the last command's
+ */
+int exit_builtin(char **inputs) {
+  exit_requested = true;
+  return inputs[1] ? atoi(inputs[1]) : last_status;
+}
+
+/**
+ * cd [dir], HOME when no dir is given
+ * @return exit status
+ */
+int cd_builtin(char **inputs) {
+  const char *dir = inputs[1] ? inputs[1] : getenv("HOME");
+  char target[PATH_MAX];
+  if (!prompt_cache.ready)
+    prompt_init();
+  if (!dir) {
+    printf("-%s: %s: HOME not set\n", sysname, inputs[0]);
+    return EXIT_FAILURE;
+  }
+  if (prompt_logical_path(dir, target, sizeof(target)) == 0 &&
+      chdir(target) == 0) {
+    prompt_set_cwd(target); // no getcwd walk for the next prompt
+    return SUCCESS;
+  }
+  if (chdir(dir) == 0) { // e.g. .. across a vanished dir
+    char cwd[PATH_MAX];
+    if (getcwd(cwd, sizeof(cwd)))
+      prompt_set_cwd(cwd);
+    return SUCCESS;
+  }
+  printf("-%s: %s: %s\n", sysname, inputs[0], strerror(errno));
+  return EXIT_FAILURE;
+}
+
+//every builtin, consulted before anything is forked: in the shell when
+//alone, forked otherwise
+struct builtin {
+  const char *name;
+  void (*func)(char **args);        // status 0 unless interrupted
+  int (*status_func)(char **args);  // used instead when it has a status
+  bool shell_state; // changes the shell, not forked even with &
+  bool shell_only;  // acts on the shell itself, a forked stage does nothing
+};
+
+static const struct builtin builtins[] = {
+    {"cd", NULL, cd_builtin, true, true},
+    {"exit", NULL, exit_builtin, true, true},
+    {"hash", hash_func, NULL, true, false},
+    {"remind", reminder, NULL, true, false},
+    {"cut", func_cut, NULL, false, false},
+    {"pstree", pstree, NULL, false, false},
+    {"chatroom", chat_func, NULL, false, false},
+    {"jobs", NULL, job_builtin, false, false}, // the table is copied by fork
+    {"fg", NULL, job_builtin, true, true},
+    {"bg", NULL, job_builtin, true, true},
+    {"wait", NULL, job_builtin, true, true},
+    {NULL, NULL, NULL, false, false},
+};
+
+const struct builtin *find_builtin(const char *name) {
+  for (int i = 0; builtins[i].name; i++)
+    if (strcmp(name, builtins[i].name) == 0)
+      return &builtins[i];
+  return NULL;
+}
+
+/**
+ * Check whether a command name is handled by the shell itself
+ */
+bool is_builtin(const char *name) { return find_builtin(name) != NULL; }
+
+static void builtin_interrupt(int sig) { builtin_interrupted = 1; }
+
+static int builtin_call(const struct builtin *builtin, char **args) {
+  if (builtin->status_func)
+    return builtin->status_func(args);
+  builtin->func(args);
+  return SUCCESS;
+}
+
+/**
+ * Run a builtin inside the shell, saving and restoring the fds its
+ * redirects replace, so a lone builtin costs no fork
+ * @param  builtin [description]
+ * @param  command [description]
+ * @return         exit status
+ */
+int run_builtin_in_shell(const struct builtin *builtin,
+                         struct command_t *command) {
+  if (builtin->func) // it may read the terminal itself, fg sets it up alone
+    editor_cooked_mode();
+  fflush(stdout);
+  int saved_in = -1, saved_out = -1;
+  if (command->redirects[0])
+    saved_in = fcntl(STDIN_FILENO, F_DUPFD_CLOEXEC, 10);
+  if (command->redirects[1] || command->redirects[2])
+    saved_out = fcntl(STDOUT_FILENO, F_DUPFD_CLOEXEC, 10);
+
+  int status = EXIT_FAILURE;
+  if (open_redirects(command) == 0) {
+    // the shell ignores Ctrl+C, the builtin stops on it instead
+    struct sigaction interrupt = {0}, old_interrupt, old_pipe;
+    interrupt.sa_handler = builtin_interrupt;
+    sigemptyset(&interrupt.sa_mask);
+    builtin_interrupted = 0;
+    if (job_control)
+      sigaction(SIGINT, &interrupt, &old_interrupt);
+    sigaction(SIGPIPE, NULL, &old_pipe); // chatroom ignores it
+
+    status = builtin_call(builtin, command->args);
+    fflush(stdout);
+
+    sigaction(SIGPIPE, &old_pipe, NULL);
+    if (job_control)
+      sigaction(SIGINT, &old_interrupt, NULL);
+    if (builtin_interrupted) {
+      builtin_interrupted = 0;
+      printf("\n");
+      status = 128 + SIGINT;
+    }
+  }
+
+  fflush(stdout);
+  if (saved_in >= 0) {
+    dup2(saved_in, STDIN_FILENO);
+    close(saved_in);
+  }
+  if (saved_out >= 0) {
+    dup2(saved_out, STDOUT_FILENO);
+    close(saved_out);
+  }
+  return status;
+}
+
+/**
+ * Run one stage inside an already forked child, never returns
+ * @param command [description]
+ */
+void exec_command(struct command_t *command) {
+  // input the shell read ahead is not ours to consume
+  __fpurge(stdin);
+  apply_redirects(command);
+
+  const struct builtin *builtin = find_builtin(command->name);
+  if (builtin) {
+    int status = builtin->shell_only ? SUCCESS
+                                     : builtin_call(builtin, command->args);
+    fflush(stdout);
+    exit(status);
+  }
+
+  execv(command->path ? command->path : command->name, command->args);
+
+  printf("-%s: %s: command not found\n", sysname, command->name);
+  exit(127);
+}
+
+extern char **environ;
+
+/**
+ * Launch an external stage with posix_spawn instead of fork+exec, so the
+ * shell's page tables are not copied for every command
+ * @param  command  stage to launch
+ * @param  fdpiping all pipes of the pipeline
+ * @param  n        number of stages
+ * @param  i        index of this stage
+ * @param  pgid     process group of the job, 0 to start one
+ * @param  pid      filled with the child's pid
+ * @return          0 or an errno value
+ */
+int spawn_command(struct command_t *command, int (*fdpiping)[2], int n, int i,
+                  pid_t pgid, pid_t *pid) {
+  posix_spawn_file_actions_t actions;
+  posix_spawn_file_actions_init(&actions);
+  posix_spawnattr_t attr;
+  posix_spawnattr_init(&attr);
+
+  if (job_control) {
+    // the shell ignores the job control signals, the child must not
+    sigset_t defaults, empty;
+    sigemptyset(&defaults);
+    sigaddset(&defaults, SIGINT);
+    sigaddset(&defaults, SIGQUIT);
+    sigaddset(&defaults, SIGTSTP);
+    sigaddset(&defaults, SIGTTIN);
+    sigaddset(&defaults, SIGTTOU);
+    sigemptyset(&empty);
+    posix_spawnattr_setsigdefault(&attr, &defaults);
+    posix_spawnattr_setsigmask(&attr, &empty);
+    posix_spawnattr_setpgroup(&attr, pgid);
+    posix_spawnattr_setflags(&attr, POSIX_SPAWN_SETPGROUP |
+                                        POSIX_SPAWN_SETSIGDEF |
+                                        POSIX_SPAWN_SETSIGMASK);
+    // take the terminal before exec, so it cannot read it too early
+    if (pgid == 0 && !command->background)
+      posix_spawn_file_actions_addtcsetpgrp_np(&actions, STDIN_FILENO);
+  }
+
+  if (i > 0)
+    posix_spawn_file_actions_adddup2(&actions, fdpiping[i - 1][0],
+                                     STDIN_FILENO);
+  if (i < n - 1)
+    posix_spawn_file_actions_adddup2(&actions, fdpiping[i][1], STDOUT_FILENO);
+  for (int j = 0; j < n - 1; j++) {
+    posix_spawn_file_actions_addclose(&actions, fdpiping[j][0]);
+    posix_spawn_file_actions_addclose(&actions, fdpiping[j][1]);
+  }
+
+  // redirects come after the pipe dup2s so they win, like apply_redirects
+  if (command->redirects[0])
+    posix_spawn_file_actions_addopen(&actions, STDIN_FILENO,
+                                     command->redirects[0], O_RDONLY, 0);
+  if (command->redirects[1])
+    posix_spawn_file_actions_addopen(&actions, STDOUT_FILENO,
+                                     command->redirects[1],
+                                     O_WRONLY | O_CREAT | O_TRUNC, 0666);
+  if (command->redirects[2])
+    posix_spawn_file_actions_addopen(&actions, STDOUT_FILENO,
+                                     command->redirects[2],
+                                     O_WRONLY | O_CREAT | O_APPEND, 0666);
+
+  int r = posix_spawn(pid, command->path ? command->path : command->name,
+                      &actions, &attr, command->args, environ);
+  posix_spawn_file_actions_destroy(&actions);
+  posix_spawnattr_destroy(&attr);
+  return r;
+}
+
+/**
+ * Run a command_t chain as one pipeline: all pipes are created up front and
+ * every stage is forked directly from the shell into the job's process group
+ * @param  command head of the chain
+ * @return         exit status of the last stage
+ */
+int run_pipeline(struct command_t *command) {
+  int n = 0;
+  for (struct command_t *c = command; c; c = c->next)
+    n++;
+
+  int(*fdpiping)[2] = malloc(sizeof(int[2]) * (n > 1 ? n - 1 : 1));
+
+  for (int i = 0; i < n - 1; i++) {
+    if (pipe(fdpiping[i]) < 0) {
+      perror("fail to pipe");
+      for (int j = 0; j < i; j++) {
+        close(fdpiping[j][0]);
+        close(fdpiping[j][1]);
+      }
+      free(fdpiping);
+      return EXIT_FAILURE;
+    }
+  }
+
+  struct job *job = job_create(command, n);
+  job->timed = time_pipeline;
+  time_pipeline = false;
+  clock_gettime(CLOCK_MONOTONIC, &job->started);
+  int status = EXIT_FAILURE;
+  struct command_t *c = command;
+  for (int i = 0; i < n; i++, c = c->next) {
+    pid_t pid;
+    // what the shell printed so far must reach stdout before the children
+    // write to it, a forked child would even print it a second time
+    fflush(stdout);
+    if (!is_builtin(c->name)) {
+      int r = spawn_command(c, fdpiping, n, i, job->pgid, &pid);
+      if (r == 0) {
+        job_add_process(job, pid, i, i == n - 1);
+        continue;
+      }
+      // ENOENT also comes back when a redirect file is missing
+      bool missing = r == ENOENT &&
+                     access(c->path ? c->path : c->name, F_OK) != 0;
+      if (missing)
+        printf("-%s: %s: command not found\n", sysname, c->name);
+      else
+        printf("-%s: %s: %s\n", sysname, c->name, strerror(r));
+      if (i == n - 1)
+        status = missing ? 127 : 126;
+      continue;
+    }
+
+    // builtins run their code in the child, they still need a real fork
+    pid = fork();
+    if (pid < 0) {
+      perror("fork failed");
+      break;
+    }
+    if (pid == 0) {
+      job_child_setup(job->pgid, !command->background);
+      if (i > 0)
+        dup2(fdpiping[i - 1][0], STDIN_FILENO);
+      if (i < n - 1)
+        dup2(fdpiping[i][1], STDOUT_FILENO);
+      for (int j = 0; j < n - 1; j++) {
+        close(fdpiping[j][0]);
+        close(fdpiping[j][1]);
+      }
+      job_remove(job); // jobs in this stage lists the jobs started before
+      exec_command(c);
+    }
+    job_add_process(job, pid, i, i == n - 1);
+  }
+
+  //parent close pipes
+  for (int j = 0; j < n - 1; j++) {
+    close(fdpiping[j][0]);
+    close(fdpiping[j][1]);
+  }
+
+  free(fdpiping);
+  job->status = status; // kept unless the last stage started
+  if (job->proc_count == 0) {
+    // a stage that failed to exec may have taken the terminal already
+    if (job_control)
+      tcsetpgrp(STDIN_FILENO, shell_pgid);
+    job_remove(job);
+    return status;
+  }
+  if (command->background) {
+    if (interactive)
+      printf("[%d] %d\n", job->id, job->procs[job->proc_count - 1].pid);
+    return SUCCESS;
+  }
+  return job_foreground(job, false, command);
+}
+
+/**
+ * Run a single pipeline of a command line, without the time prefix
+ * @param  command head of the pipeline
+ * @return         EXIT if the shell should quit, SUCCESS otherwise
+ */
+int dispatch_pipeline(struct command_t *command) {
+  if (strcmp(command->name, "") == 0)
+    return SUCCESS;
+
+  // a lone builtin needs no fork, pipelines and background jobs still do
+  const struct builtin *builtin = find_builtin(command->name);
+  if (builtin && !command->next &&
+      (builtin->shell_state || !command->background)) {
+    last_status = run_builtin_in_shell(builtin, command);
+    return exit_requested ? EXIT : SUCCESS;
+  }
+
+  // resolve in the shell so the lookup cache outlives the fork
+  for (struct command_t *c = command; c; c = c->next)
+    if (!c->path && !is_builtin(c->name))
+      c->path = path_resolver(c->name);
+
+  last_status = run_pipeline(command);
+  return SUCCESS;
+}
+
+/**
+ * Run a single pipeline of a command line. With a time prefix the job
+ * reports its cost per stage, builtins run by the shell report the
+ * shell's own usage instead.
+ * @param  command head of the pipeline
+ * @return         EXIT if the shell should quit, SUCCESS otherwise
+ */
+int process_pipeline(struct command_t *command) {
+  if (strcmp(command->name, "time") != 0)
+    return dispatch_pipeline(command);
+
+  command->args++;
+  command->arg_count--;
+  command->name = command->args[0] ? command->args[0] : "";
+
+  struct timespec started, now;
+  struct rusage before, after;
+  clock_gettime(CLOCK_MONOTONIC, &started);
+  getrusage(RUSAGE_SELF, &before);
+  time_pipeline = true;
+  int r = dispatch_pipeline(command);
+  if (time_pipeline) { // no job was started
+    time_pipeline = false;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    getrusage(RUSAGE_SELF, &after);
+    struct rusage used = after;
+    timersub(&after.ru_utime, &before.ru_utime, &used.ru_utime);
+    timersub(&after.ru_stime, &before.ru_stime, &used.ru_stime);
+    used.ru_nvcsw -= before.ru_nvcsw;
+    used.ru_nivcsw -= before.ru_nivcsw;
+    used.ru_minflt -= before.ru_minflt;
+    used.ru_majflt -= before.ru_majflt;
+    time_header();
+    time_row("total", timespec_diff(&started, &now), &used, "");
+  }
+  return r;
+}
+
+/**
+ * Run every pipeline of a parsed command line, honouring && and ||
+ * @param  command first pipeline
+ * @return         EXIT if the shell should quit, SUCCESS otherwise
+ */
+int process_command(struct command_t *command) {
+  bool run = true;
+  for (struct command_t *p = command; p; p = p->next_list) {
+    if (run && process_pipeline(p) == EXIT)
+      return EXIT;
+    // a skipped pipeline passes on the status of the last one that ran
+    if (p->list_op == LIST_AND)
+      run = last_status == 0;
+    else if (p->list_op == LIST_OR)
+      run = last_status != 0;
+    else
+      run = true;
+  }
+  return SUCCESS;
+}
+
+/**
+ * Run every line of a script without prompting or touching the terminal
+ * @param  in input to run
+ * @return    exit status of the last command
+ */
+int run_batch(struct batch_input *in) {
+  char *line;
+  while ((line = batch_next_line(in)) != NULL) {
+    const char *p = line;
+    while (*p == ' ' || *p == '\t')
+      p++;
+    if (*p == '\0' || *p == '#') // blank lines, comments and #!
+      continue;
+
+    jobs_reap();
+    jobs_notify(); // prints nothing here, but drops the finished jobs
+    struct command_t *command =
+        arena_alloc(&cmd_arena, sizeof(struct command_t)); // zeroed
+    if (parse_command(line, command) != 0)
+      last_status = 2;
+    int code = process_command(command);
+    free_command(command);
+    if (code == EXIT)
+      break;
+  }
+  free(in->data);
+  return last_status;
+}
+
+/**
+ * shellish                 interactive on a terminal, otherwise reads stdin
+ * shellish -c "commands"   runs the commands and exits
+ * shellish script [...]    runs the script and exits
+ */
+int main(int argc, char **argv) {
+  struct batch_input in = {STDIN_FILENO, NULL, 0, 0, 0};
+  if (argc > 2 && strcmp(argv[1], "-c") == 0) {
+    in.fd = -1;
+    in.len = in.cap = strlen(argv[2]);
+    in.data = malloc(in.len + 1);
+    memcpy(in.data, argv[2], in.len);
+    interactive = false;
+  } else if (argc > 1) {
+    in.fd = open(argv[1], O_RDONLY | O_CLOEXEC);
+    if (in.fd < 0) {
+      fprintf(stderr, "%s: %s: %s\n", sysname, argv[1], strerror(errno));
+      return 127;
+    }
+    interactive = false;
+  } else if (!isatty(STDIN_FILENO)) {
+    interactive = false;
+  }
+
+  // pending reminders survive restarts through the journal
+  const char *home = getenv("HOME");
+  if (home) {
+    char journal[PATH_MAX];
+    snprintf(journal, sizeof(journal), "%s/.shellish_reminders", home);
+    reminders_load(journal, interactive);
+    if (interactive) {
+      snprintf(journal, sizeof(journal), "%s/.shellish_history", home);
+      history_load(journal);
+    }
+  }
+  jobs_init();
+
+  if (!interactive) {
+    if (!in.data) { // the first memchr in batch_next_line reads it
+      in.cap = BATCH_BLOCK_SIZE + 1;
+      in.data = malloc(in.cap);
+    }
+    return run_batch(&in);
+  }
+
+  while (1) {
+    struct command_t *command =
+        arena_alloc(&cmd_arena, sizeof(struct command_t)); // zeroed
+
+    jobs_reap();
+    jobs_notify();
+
+    int code;
+    code = prompt(command);
+    if (code == EXIT)
+      break;
+
+    code = process_command(command);
     if (code == EXIT)
       break;
 
     free_command(command);
   }
 
-  printf("\n");
-  return 0;
+  editor_cooked_mode();
+  return last_status;
 }